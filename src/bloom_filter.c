@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "bloom_filter.h"
+
+#define BLOOM_BITS_PER_KEY 10
+// Optimal for ten bits per key, ln(2) * 10 rounded down
+#define BLOOM_PROBES_COUNT 6
+
+void bloom_filters_init(BloomFilters* b, u32 filters_count, u32 max_keys_per_filter)
+{
+    assert(b && "Must provide a valid BloomFilters");
+    memset(b, 0, sizeof(*b));
+
+    // Round up to a power of two so probe positions are a mask away from the hash
+    u32 bits = 64;
+    while (bits < max_keys_per_filter * BLOOM_BITS_PER_KEY) {
+        bits *= 2;
+    }
+    b->filters_count = filters_count;
+    b->filter_words = bits / 64;
+    b->filter_bits_mask = bits - 1;
+    b->words = calloc((size_t)filters_count * b->filter_words, sizeof(*b->words));
+    b->active = calloc(filters_count, sizeof(*b->active));
+    if (!b->words || !b->active) {
+        printf("Error allocating Bloom filters.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void bloom_filters_destroy(BloomFilters* b)
+{
+    free(b->words);
+    free(b->active);
+    memset(b, 0, sizeof(*b));
+}
+
+static u64* filter_words(BloomFilters* b, u32 filter)
+{
+    assert(filter < b->filters_count && "Bloom filter index out of range");
+    return b->words + (size_t)filter * b->filter_words;
+}
+
+void bloom_filters_reset(BloomFilters* b, u32 filter)
+{
+    memset(filter_words(b, filter), 0, b->filter_words * sizeof(*b->words));
+    b->active[filter] = true;
+}
+
+void bloom_filters_deactivate(BloomFilters* b, u32 filter)
+{
+    assert(filter < b->filters_count && "Bloom filter index out of range");
+    b->active[filter] = false;
+}
+
+bool bloom_filters_is_active(BloomFilters* b, u32 filter)
+{
+    return filter < b->filters_count && b->active[filter];
+}
+
+// Double hashing, probe i looks at h1 + i * h2 with both halves taken from the caller's hash
+void bloom_filters_add(BloomFilters* b, u32 filter, u64 hash)
+{
+    u64* words = filter_words(b, filter);
+    u32 h1 = (u32)hash;
+    u32 h2 = (u32)(hash >> 32) | 1;
+    for (u32 i = 0; i < BLOOM_PROBES_COUNT; i++) {
+        u32 bit = (h1 + i * h2) & b->filter_bits_mask;
+        words[bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+bool bloom_filters_may_contain(BloomFilters* b, u32 filter, u64 hash)
+{
+    u64* words = filter_words(b, filter);
+    u32 h1 = (u32)hash;
+    u32 h2 = (u32)(hash >> 32) | 1;
+    for (u32 i = 0; i < BLOOM_PROBES_COUNT; i++) {
+        u32 bit = (h1 + i * h2) & b->filter_bits_mask;
+        if (!(words[bit / 64] & (1ull << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
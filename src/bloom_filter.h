@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "int_types.h"
+
+/*
+    A fixed number of equally sized Bloom filters sharing one allocation, addressed by index.
+    Filters are sized for a known maximum number of keys at about ten bits per key, which keeps
+    false positives around one percent. Callers hash their keys themselves, the filters only
+    derive their probe positions from that 64-bit hash.
+    A filter starts out inactive; it has to be reset before keys can be added to it.
+*/
+typedef struct {
+    u64* words;
+    bool* active;
+    u32 filters_count;
+    u32 filter_words;
+    u32 filter_bits_mask;
+} BloomFilters;
+
+void bloom_filters_init(BloomFilters* b, u32 filters_count, u32 max_keys_per_filter);
+void bloom_filters_destroy(BloomFilters* b);
+// Clears the filter and marks it active
+void bloom_filters_reset(BloomFilters* b, u32 filter);
+void bloom_filters_deactivate(BloomFilters* b, u32 filter);
+bool bloom_filters_is_active(BloomFilters* b, u32 filter);
+void bloom_filters_add(BloomFilters* b, u32 filter, u64 hash);
+// False means the hash was definitely never added, true means it probably was
+bool bloom_filters_may_contain(BloomFilters* b, u32 filter, u64 hash);
@@ -0,0 +1,3156 @@
+// Keep off_t 64 bits wide on 32-bit targets too
+#define _FILE_OFFSET_BITS 64
+// fallocate is a GNU extension
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <io.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "array.h"
+#include "bloom_filter.h"
+#include "db.h"
+#include "file_copy.h"
+#include "frame_arena.h"
+#include "int_types.h"
+#include "lz_codec.h"
+#include "page_io.h"
+#include "row_cache.h"
+#include "sorter.h"
+#include "text_match.h"
+
+// Serialized Row Layout, the key takes as many bytes as the table's key type needs
+#define SIZE_OF_MEMBER(Struct, Member) sizeof(((Struct*)0)->Member)
+#define ROW_SIZE_FOR_KEY(key_size) ((key_size) + USERNAME_SIZE + EMAIL_SIZE)
+const size_t USERNAME_SIZE = SIZE_OF_MEMBER(Row, username);
+const size_t EMAIL_SIZE = SIZE_OF_MEMBER(Row, email);
+const size_t KEY_OFFSET = 0;
+
+
+typedef struct {
+    Table* table;
+    u32 page_num;
+    u32 cell_num;
+    bool end_of_table;
+} Cursor;
+
+typedef enum {
+    NODE_INTERNAL,
+    NODE_LEAF
+} NodeType;
+
+typedef enum {
+    PAGE_READ_OK,
+    PAGE_READ_IO_ERROR,
+    // A compressed frame that does not decode
+    PAGE_READ_CORRUPT
+} PageReadResult;
+
+// Common Node Header Layout
+const u32 NODE_TYPE_SIZE = sizeof(u8);
+const u32 NODE_TYPE_OFFSET = 0;
+const u32 IS_ROOT_SIZE = sizeof(u8);
+const u32 IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+const u32 PARENT_POINTER_SIZE = sizeof(u32);
+const u32 PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+const u32 COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+
+// Leaf Node Header Layout
+const u32 LEAF_NODE_CELLS_COUNT_SIZE = sizeof(u32);
+const u32 LEAF_NODE_CELLS_COUNT_OFFSET = COMMON_NODE_HEADER_SIZE;
+const u32 LEAF_NODE_NEXT_LEAF_SIZE = sizeof(u32);
+const u32 LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_CELLS_COUNT_OFFSET + LEAF_NODE_CELLS_COUNT_SIZE;
+const u32 LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_CELLS_COUNT_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
+
+// Leaf Node Body Layout, each cell is the key followed by the serialized row
+#define LEAF_NODE_CELL_SIZE_FOR_KEY(key_size) ((key_size) + ROW_SIZE_FOR_KEY(key_size))
+const u32 LEAF_NODE_KEY_OFFSET = 0;
+
+// Internal Node Header Layout
+const u32 INTERNAL_NODE_KEYS_COUNT_SIZE = sizeof(u32);
+const u32 INTERNAL_NODE_KEYS_COUNT_OFFSET = COMMON_NODE_HEADER_SIZE;
+const u32 INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(u32);
+const u32 INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_KEYS_COUNT_OFFSET + INTERNAL_NODE_KEYS_COUNT_SIZE;
+const u32 INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_KEYS_COUNT_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+
+// Internal Node Body Layout, each cell is a child page number followed by the child's max key
+#define INTERNAL_NODE_CELL_SIZE_FOR_KEY(key_size) (INTERNAL_NODE_CHILD_SIZE + (key_size))
+const u32 INTERNAL_NODE_CHILD_SIZE = sizeof(u32);
+/* Keep this small for testing */
+const u32 INTERNAL_NODE_MAX_CELLS = 3;
+
+// Database Header Layout, stored at the start of page 0
+#define DB_HEADER_MAGIC "MySQLite format"
+#define DB_FORMAT_VERSION 1
+const u32 DB_HEADER_MAGIC_SIZE = sizeof(DB_HEADER_MAGIC);
+const u32 DB_HEADER_MAGIC_OFFSET = 0;
+const u32 DB_HEADER_FORMAT_VERSION_SIZE = sizeof(u32);
+const u32 DB_HEADER_FORMAT_VERSION_OFFSET = DB_HEADER_MAGIC_OFFSET + DB_HEADER_MAGIC_SIZE;
+const u32 DB_HEADER_PAGE_SIZE_SIZE = sizeof(u32);
+const u32 DB_HEADER_PAGE_SIZE_OFFSET = DB_HEADER_FORMAT_VERSION_OFFSET + DB_HEADER_FORMAT_VERSION_SIZE;
+const u32 DB_HEADER_ROOT_PAGE_SIZE = sizeof(u32);
+const u32 DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_PAGE_SIZE_OFFSET + DB_HEADER_PAGE_SIZE_SIZE;
+const u32 DB_HEADER_PAGES_COUNT_SIZE = sizeof(u32);
+const u32 DB_HEADER_PAGES_COUNT_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + DB_HEADER_ROOT_PAGE_SIZE;
+// Zero means KEY_TYPE_U32, which is what files written before key types existed use
+const u32 DB_HEADER_KEY_TYPE_SIZE = sizeof(u32);
+const u32 DB_HEADER_KEY_TYPE_OFFSET = DB_HEADER_PAGES_COUNT_OFFSET + DB_HEADER_PAGES_COUNT_SIZE;
+// Optional features as DB_FLAG_* bits, files written before flags existed have zero here
+const u32 DB_HEADER_FLAGS_SIZE = sizeof(u32);
+const u32 DB_HEADER_FLAGS_OFFSET = DB_HEADER_KEY_TYPE_OFFSET + DB_HEADER_KEY_TYPE_SIZE;
+const u32 DB_HEADER_SIZE = DB_HEADER_MAGIC_SIZE + DB_HEADER_FORMAT_VERSION_SIZE + DB_HEADER_PAGE_SIZE_SIZE + DB_HEADER_ROOT_PAGE_SIZE + DB_HEADER_PAGES_COUNT_SIZE + DB_HEADER_KEY_TYPE_SIZE + DB_HEADER_FLAGS_SIZE;
+
+// Pages other than page 0 may be stored as compressed frames, see pager_encode_page
+#define DB_FLAG_COMPRESSED_PAGES (1u << 0)
+#define DB_KNOWN_FLAGS DB_FLAG_COMPRESSED_PAGES
+
+/*
+    Compressed Page Frame Layout, stored at the start of the page's slot in the file with the rest
+    of the slot left as a hole. The magic's first byte is never a valid node type, so a reader can
+    tell a frame from a page stored as is.
+*/
+#define PAGE_FRAME_MAGIC 0x4650434Du
+const u32 PAGE_FRAME_MAGIC_SIZE = sizeof(u32);
+const u32 PAGE_FRAME_MAGIC_OFFSET = 0;
+const u32 PAGE_FRAME_COMPRESSED_SIZE_SIZE = sizeof(u32);
+const u32 PAGE_FRAME_COMPRESSED_SIZE_OFFSET = PAGE_FRAME_MAGIC_OFFSET + PAGE_FRAME_MAGIC_SIZE;
+const u32 PAGE_FRAME_PACKED_SIZE_SIZE = sizeof(u32);
+const u32 PAGE_FRAME_PACKED_SIZE_OFFSET = PAGE_FRAME_COMPRESSED_SIZE_OFFSET + PAGE_FRAME_COMPRESSED_SIZE_SIZE;
+const u32 PAGE_FRAME_HEADER_SIZE = PAGE_FRAME_MAGIC_SIZE + PAGE_FRAME_COMPRESSED_SIZE_SIZE + PAGE_FRAME_PACKED_SIZE_SIZE;
+// Holes are punched in whole filesystem blocks, a frame has to save at least one to be worth storing
+#define PAGE_FRAME_BLOCK_SIZE 4096
+
+// Header utils
+char* db_header_magic(void* header) { return header + DB_HEADER_MAGIC_OFFSET; }
+u32* db_header_format_version(void* header) { return header + DB_HEADER_FORMAT_VERSION_OFFSET; }
+u32* db_header_page_size(void* header) { return header + DB_HEADER_PAGE_SIZE_OFFSET; }
+u32* db_header_root_page(void* header) { return header + DB_HEADER_ROOT_PAGE_OFFSET; }
+u32* db_header_pages_count(void* header) { return header + DB_HEADER_PAGES_COUNT_OFFSET; }
+u32* db_header_key_type(void* header) { return header + DB_HEADER_KEY_TYPE_OFFSET; }
+u32* db_header_flags(void* header) { return header + DB_HEADER_FLAGS_OFFSET; }
+
+// Compressed page frame utils
+u32* page_frame_magic(void* frame) { return frame + PAGE_FRAME_MAGIC_OFFSET; }
+u32* page_frame_compressed_size(void* frame) { return frame + PAGE_FRAME_COMPRESSED_SIZE_OFFSET; }
+u32* page_frame_packed_size(void* frame) { return frame + PAGE_FRAME_PACKED_SIZE_OFFSET; }
+
+NodeType get_node_type(void* node) { return (NodeType)*((u8*)(node + NODE_TYPE_OFFSET)); }
+void set_node_type(void* node, NodeType type) { *((u8*)(node + NODE_TYPE_OFFSET)) = (u8)type; }
+
+// Leaf nodes utils
+u32* leaf_node_cells_count(void* node) { return node + LEAF_NODE_CELLS_COUNT_OFFSET; }
+void* leaf_node_cell(Pager* p, void* node, u32 cell_num) { return node + LEAF_NODE_HEADER_SIZE + cell_num * p->leaf_node_cell_size; }
+void* leaf_node_key(Pager* p, void* node, u32 cell_num) { return leaf_node_cell(p, node, cell_num) + LEAF_NODE_KEY_OFFSET; }
+void* leaf_node_value(Pager* p, void* node, u32 cell_num) { return leaf_node_cell(p, node, cell_num) + p->key_size; }
+u32* leaf_node_next_leaf(void* node) { return node + LEAF_NODE_NEXT_LEAF_OFFSET; }
+
+// Internal nodes utils
+u32* internal_node_keys_count(void* node) { return node + INTERNAL_NODE_KEYS_COUNT_OFFSET; }
+u32* internal_node_right_child(void* node) { return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET; }
+u32* internal_node_cell(Pager* p, void* node, u32 cell_num) { return node + INTERNAL_NODE_HEADER_SIZE + cell_num * p->internal_node_cell_size; }
+void* internal_node_key(Pager* p, void* node, u32 key_num) { return (void*)internal_node_cell(p, node, key_num) + INTERNAL_NODE_CHILD_SIZE; }
+
+u32* internal_node_child(Pager* p, void* node, u32 child_num)
+{
+    u32 keys_count = *internal_node_keys_count(node);
+    if (child_num > keys_count) {
+        printf("Tried to access child_num %u > keys_count %u\n", child_num, keys_count);
+        exit(EXIT_FAILURE);
+    }
+    if (child_num == keys_count) {
+        u32* right_child = internal_node_right_child(node);
+        if (*right_child == INVALID_PAGE_NUM) {
+            printf("Tried to access right child of node, but was an invalid page\n");
+            exit(EXIT_FAILURE);
+        }
+        return right_child;
+    }
+
+    u32* child = internal_node_cell(p, node, child_num);
+    if (*child == INVALID_PAGE_NUM) {
+        printf("Tried to access child %u of node, but was an invalid page\n", child_num);
+        exit(EXIT_FAILURE);
+    }
+    return child;
+}
+
+bool is_node_root(void* node)
+{
+    return (bool)*((u8*)(node + IS_ROOT_OFFSET));
+}
+
+void set_node_root(void* node, bool is_root)
+{
+    *((u8*)(node + IS_ROOT_OFFSET)) = (u8)is_root;
+}
+
+u32* node_parent(void* node)
+{
+    return node + PARENT_POINTER_OFFSET;
+}
+
+void initialize_leaf_node(void* node)
+{
+    set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
+    *leaf_node_cells_count(node) = 0;
+    *leaf_node_next_leaf(node) = 0; // 0 means no sibling
+}
+
+void initialize_internal_node(void* node)
+{
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_keys_count(node) = 0;
+    /*
+        Necessary because the root page number is 0; by not initializing an internal
+        node's right child to an invalid page number when initializing the node, we may
+        end up with 0 as the node's right child, which makes the node a parent of the root
+    */
+    *internal_node_right_child(node) = INVALID_PAGE_NUM;
+}
+
+u32 key_type_size(KeyType type)
+{
+    switch (type) {
+        case KEY_TYPE_U32: return sizeof(u32);
+        case KEY_TYPE_U64: return sizeof(u64);
+        case KEY_TYPE_COMPOSITE: return 2 * sizeof(u64);
+        default:
+            assert(false && "Invalid key type in key_type_size");
+            return 0;
+    }
+}
+
+const char* key_type_name(KeyType type)
+{
+    switch (type) {
+        case KEY_TYPE_U32: return "u32";
+        case KEY_TYPE_U64: return "u64";
+        case KEY_TYPE_COMPOSITE: return "composite";
+        default:
+            assert(false && "Invalid key type in key_type_name");
+            return "unknown";
+    }
+}
+
+i32 key_compare(Key a, Key b)
+{
+    if (a.tenant != b.tenant) {
+        return a.tenant < b.tenant ? -1 : 1;
+    }
+    if (a.id != b.id) {
+        return a.id < b.id ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+    Per key type routines. Each type gets its own load, store and compare plus the leaf and internal
+    node binary searches built on them, with the key width and cell sizes as compile time constants.
+    That way the u32 and u64 searches compile down to plain integer loads and compares instead of
+    going through a generic compare on every probe. Only the entry points below switch on the key type.
+*/
+static inline Key key_load_u32(const void* src) { u32 id; memcpy(&id, src, sizeof(id)); return (Key){ .tenant = 0, .id = id }; }
+static inline void key_store_u32(void* dst, Key key) { u32 id = (u32)key.id; memcpy(dst, &id, sizeof(id)); }
+static inline i32 key_compare_u32(const void* stored, Key key)
+{
+    u32 id;
+    memcpy(&id, stored, sizeof(id));
+    return (id > key.id) - (id < key.id);
+}
+
+static inline Key key_load_u64(const void* src) { u64 id; memcpy(&id, src, sizeof(id)); return (Key){ .tenant = 0, .id = id }; }
+static inline void key_store_u64(void* dst, Key key) { memcpy(dst, &key.id, sizeof(key.id)); }
+static inline i32 key_compare_u64(const void* stored, Key key)
+{
+    u64 id;
+    memcpy(&id, stored, sizeof(id));
+    return (id > key.id) - (id < key.id);
+}
+
+static inline Key key_load_composite(const void* src)
+{
+    Key key;
+    memcpy(&key.tenant, src, sizeof(key.tenant));
+    memcpy(&key.id, (const u8*)src + sizeof(key.tenant), sizeof(key.id));
+    return key;
+}
+static inline void key_store_composite(void* dst, Key key)
+{
+    memcpy(dst, &key.tenant, sizeof(key.tenant));
+    memcpy((u8*)dst + sizeof(key.tenant), &key.id, sizeof(key.id));
+}
+static inline i32 key_compare_composite(const void* stored, Key key)
+{
+    return key_compare(key_load_composite(stored), key);
+}
+
+#define DEFINE_KEY_SEARCH(name, key_size) \
+    /* Returns the index of the key, or where it would be inserted. found tells the two apart */ \
+    static u32 leaf_node_search_##name(void* node, Key key, bool* found) \
+    { \
+        const u32 cell_size = LEAF_NODE_CELL_SIZE_FOR_KEY(key_size); \
+        u8* cells = (u8*)node + LEAF_NODE_HEADER_SIZE + LEAF_NODE_KEY_OFFSET; \
+        u32 min_index = 0; \
+        u32 one_past_max_index = *leaf_node_cells_count(node); \
+        while (one_past_max_index != min_index) { \
+            u32 index = (min_index + one_past_max_index) / 2; \
+            i32 cmp = key_compare_##name(cells + index * cell_size, key); \
+            if (cmp == 0) { \
+                *found = true; \
+                return index; \
+            } \
+            if (cmp > 0) { \
+                one_past_max_index = index; \
+            } else { \
+                min_index = index + 1; \
+            } \
+        } \
+        *found = false; \
+        return min_index; \
+    } \
+    \
+    /* Returns the index of the first child whose max key is >= key */ \
+    static u32 internal_node_find_child_##name(void* node, Key key) \
+    { \
+        const u32 cell_size = INTERNAL_NODE_CELL_SIZE_FOR_KEY(key_size); \
+        u8* keys = (u8*)node + INTERNAL_NODE_HEADER_SIZE + INTERNAL_NODE_CHILD_SIZE; \
+        u32 min_index = 0; \
+        u32 max_index = *internal_node_keys_count(node); /* There is one more child than key */ \
+        while (min_index != max_index) { \
+            u32 index = (min_index + max_index) / 2; \
+            if (key_compare_##name(keys + index * cell_size, key) >= 0) { \
+                max_index = index; \
+            } else { \
+                min_index = index + 1; \
+            } \
+        } \
+        return min_index; \
+    }
+
+DEFINE_KEY_SEARCH(u32, sizeof(u32))
+DEFINE_KEY_SEARCH(u64, sizeof(u64))
+DEFINE_KEY_SEARCH(composite, 2 * sizeof(u64))
+
+Key key_load(Pager* p, const void* src)
+{
+    switch (p->key_type) {
+        case KEY_TYPE_U32: return key_load_u32(src);
+        case KEY_TYPE_U64: return key_load_u64(src);
+        case KEY_TYPE_COMPOSITE: return key_load_composite(src);
+        default:
+            assert(false && "Invalid key type in key_load");
+            return (Key){0};
+    }
+}
+
+void key_store(Pager* p, void* dst, Key key)
+{
+    switch (p->key_type) {
+        case KEY_TYPE_U32: key_store_u32(dst, key); break;
+        case KEY_TYPE_U64: key_store_u64(dst, key); break;
+        case KEY_TYPE_COMPOSITE: key_store_composite(dst, key); break;
+        default:
+            assert(false && "Invalid key type in key_store");
+    }
+}
+
+u32 leaf_node_search(Pager* p, void* node, Key key, bool* found)
+{
+    switch (p->key_type) {
+        case KEY_TYPE_U32: return leaf_node_search_u32(node, key, found);
+        case KEY_TYPE_U64: return leaf_node_search_u64(node, key, found);
+        case KEY_TYPE_COMPOSITE: return leaf_node_search_composite(node, key, found);
+        default:
+            assert(false && "Invalid key type in leaf_node_search");
+            return 0;
+    }
+}
+
+u32 internal_node_find_child(Pager* p, void* node, Key key)
+{
+    // Return the index of the child which should contain the given key.
+    switch (p->key_type) {
+        case KEY_TYPE_U32: return internal_node_find_child_u32(node, key);
+        case KEY_TYPE_U64: return internal_node_find_child_u64(node, key);
+        case KEY_TYPE_COMPOSITE: return internal_node_find_child_composite(node, key);
+        default:
+            assert(false && "Invalid key type in internal_node_find_child");
+            return 0;
+    }
+}
+
+// Enough for a composite key, two 20 digit numbers and a colon
+#define KEY_TEXT_SIZE 48
+
+void format_key(Pager* p, Key key, char* text)
+{
+    if (p->key_type == KEY_TYPE_COMPOSITE) {
+        snprintf(text, KEY_TEXT_SIZE, "%llu:%llu", (unsigned long long)key.tenant, (unsigned long long)key.id);
+    } else {
+        snprintf(text, KEY_TEXT_SIZE, "%llu", (unsigned long long)key.id);
+    }
+}
+
+void print_key(Pager* p, Key key)
+{
+    char text[KEY_TEXT_SIZE];
+    format_key(p, key, text);
+    printf("%s", text);
+}
+
+u32 row_username_offset(Pager* p) { return KEY_OFFSET + p->key_size; }
+u32 row_email_offset(Pager* p) { return row_username_offset(p) + USERNAME_SIZE; }
+
+// LEB128, seven bits per byte with the high bit set on every byte but the last
+u32 varint_write(u8* dst, u64 value)
+{
+    u32 n = 0;
+    while (value >= 0x80) {
+        dst[n++] = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    dst[n++] = (u8)value;
+    return n;
+}
+
+bool varint_read(const u8** src, const u8* end, u64* value)
+{
+    *value = 0;
+    for (u32 shift = 0; shift < 64 && *src < end; shift += 7) {
+        u8 byte = *(*src)++;
+        *value |= (u64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Length of a zero padded column slot without its trailing zeros, so trimming it loses nothing
+u32 slot_trimmed_length(const u8* slot, u32 slot_size)
+{
+    while (slot_size > 0 && slot[slot_size - 1] == 0) {
+        slot_size--;
+    }
+    return slot_size;
+}
+
+/*
+    Packing is the first stage of page compression and takes out what a general purpose codec is
+    bad at. A leaf keeps its header, then each cell becomes its key as a delta from the previous
+    one followed by the username and email without their padding. The copy of the key inside the
+    row is dropped since it matches the cell's. Composite keys store the tenant as a delta
+    and the id as a delta only while the tenant stays the same. Internal nodes are small and keep
+    their bytes, minus the unused cells.
+    Returns the packed size, or 0 if the page cannot be packed into capacity bytes.
+*/
+u32 page_pack(Pager* p, void* page, u8* dst, u32 capacity)
+{
+    if (get_node_type(page) == NODE_INTERNAL) {
+        u32 keys_count = *internal_node_keys_count(page);
+        u32 size = INTERNAL_NODE_HEADER_SIZE + keys_count * p->internal_node_cell_size;
+        if (keys_count > INTERNAL_NODE_MAX_CELLS || size > capacity) {
+            return 0;
+        }
+        memcpy(dst, page, size);
+        return size;
+    }
+    if (get_node_type(page) != NODE_LEAF || *leaf_node_cells_count(page) > p->leaf_node_max_cells) {
+        return 0;
+    }
+
+    // Worst case for one cell: two 10 byte varints for the key, two for the column lengths and both full columns
+    const u32 max_cell_size = 4 * 10 + USERNAME_SIZE + EMAIL_SIZE;
+    u32 n = LEAF_NODE_HEADER_SIZE;
+    memcpy(dst, page, LEAF_NODE_HEADER_SIZE);
+    Key previous = {0};
+    for (u32 i = 0; i < *leaf_node_cells_count(page); i++) {
+        if (n + max_cell_size > capacity) {
+            return 0;
+        }
+        Key key = key_load(p, leaf_node_key(p, page, i));
+        u8* row = leaf_node_value(p, page, i);
+        // Cells are sorted and rows carry their cell's key, a page breaking either is stored as is
+        if (key_compare(key, previous) < 0 || key_compare(key, key_load(p, row + KEY_OFFSET)) != 0) {
+            return 0;
+        }
+        if (p->key_type == KEY_TYPE_COMPOSITE) {
+            n += varint_write(dst + n, key.tenant - previous.tenant);
+            n += varint_write(dst + n, key.tenant == previous.tenant ? key.id - previous.id : key.id);
+        } else {
+            n += varint_write(dst + n, key.id - previous.id);
+        }
+        previous = key;
+
+        u32 username_length = slot_trimmed_length(row + row_username_offset(p), USERNAME_SIZE);
+        n += varint_write(dst + n, username_length);
+        memcpy(dst + n, row + row_username_offset(p), username_length);
+        n += username_length;
+        u32 email_length = slot_trimmed_length(row + row_email_offset(p), EMAIL_SIZE);
+        n += varint_write(dst + n, email_length);
+        memcpy(dst + n, row + row_email_offset(p), email_length);
+        n += email_length;
+    }
+    return n;
+}
+
+// Rebuilds a page from page_pack's output. Bytes past the last cell come back as zeros
+bool page_unpack(Pager* p, const u8* src, u32 size, void* page)
+{
+    const u8* end = src + size;
+    if (size < COMMON_NODE_HEADER_SIZE) {
+        return false;
+    }
+    memset(page, 0, p->page_size);
+    if (get_node_type((void*)src) == NODE_INTERNAL) {
+        if (size > p->page_size) {
+            return false;
+        }
+        memcpy(page, src, size);
+        return size >= INTERNAL_NODE_HEADER_SIZE &&
+               size == INTERNAL_NODE_HEADER_SIZE + *internal_node_keys_count(page) * p->internal_node_cell_size;
+    }
+    if (get_node_type((void*)src) != NODE_LEAF || size < LEAF_NODE_HEADER_SIZE) {
+        return false;
+    }
+    memcpy(page, src, LEAF_NODE_HEADER_SIZE);
+    if (*leaf_node_cells_count(page) > p->leaf_node_max_cells) {
+        return false;
+    }
+
+    src += LEAF_NODE_HEADER_SIZE;
+    Key key = {0};
+    for (u32 i = 0; i < *leaf_node_cells_count(page); i++) {
+        u64 tenant_delta = 0;
+        u64 id = 0;
+        if (p->key_type == KEY_TYPE_COMPOSITE && !varint_read(&src, end, &tenant_delta)) {
+            return false;
+        }
+        if (!varint_read(&src, end, &id)) {
+            return false;
+        }
+        key.id = tenant_delta == 0 ? key.id + id : id;
+        key.tenant += tenant_delta;
+        key_store(p, leaf_node_key(p, page, i), key);
+        u8* row = leaf_node_value(p, page, i);
+        key_store(p, row + KEY_OFFSET, key);
+
+        u64 username_length = 0;
+        if (!varint_read(&src, end, &username_length) || username_length > USERNAME_SIZE ||
+            (u64)(end - src) < username_length) {
+            return false;
+        }
+        memcpy(row + row_username_offset(p), src, username_length);
+        src += username_length;
+        u64 email_length = 0;
+        if (!varint_read(&src, end, &email_length) || email_length > EMAIL_SIZE || (u64)(end - src) < email_length) {
+            return false;
+        }
+        memcpy(row + row_email_offset(p), src, email_length);
+        src += email_length;
+    }
+    return src == end;
+}
+
+/*
+    Picks what to write for a page. In a file with compressed pages that is a frame built in buffer,
+    which must hold a page, as long as the frame frees at least one block of the page's slot.
+    Otherwise, and always for page 0 so the header can be read before anything is known about the
+    file, it is the page itself. size is set to the number of bytes to write at the slot's start.
+*/
+void* pager_encode_page(Pager* p, u32 page_num, u8* buffer, u32* size)
+{
+    void* page = p->pages[page_num];
+    *size = p->page_size;
+    if (!p->compress_pages || page_num == 0 || p->page_size <= PAGE_FRAME_BLOCK_SIZE) {
+        return page;
+    }
+    u32 packed_size = page_pack(p, page, p->packed_buffer, 2 * p->page_size);
+    if (packed_size == 0) {
+        return page;
+    }
+    u32 capacity = p->page_size - PAGE_FRAME_BLOCK_SIZE - PAGE_FRAME_HEADER_SIZE;
+    u32 compressed_size = lz_compress(p->packed_buffer, packed_size, buffer + PAGE_FRAME_HEADER_SIZE, capacity);
+    if (compressed_size == 0) {
+        return page;
+    }
+    *page_frame_magic(buffer) = PAGE_FRAME_MAGIC;
+    *page_frame_compressed_size(buffer) = compressed_size;
+    *page_frame_packed_size(buffer) = packed_size;
+    *size = PAGE_FRAME_HEADER_SIZE + compressed_size;
+    return buffer;
+}
+
+/*
+    Turns a page read from the file back into its in-memory form, in place. Pages stored as is are
+    left alone. scratch must hold two pages.
+    Returns false if the page is a frame that does not decode.
+*/
+bool pager_decode_page(Pager* p, u32 page_num, void* page, u8* scratch)
+{
+    if (!p->compress_pages || page_num == 0 || *page_frame_magic(page) != PAGE_FRAME_MAGIC) {
+        return true;
+    }
+    u32 compressed_size = *page_frame_compressed_size(page);
+    u32 packed_size = *page_frame_packed_size(page);
+    if (compressed_size > p->page_size - PAGE_FRAME_HEADER_SIZE || packed_size > 2 * p->page_size) {
+        return false;
+    }
+    return lz_decompress((u8*)page + PAGE_FRAME_HEADER_SIZE, compressed_size, scratch, packed_size) &&
+           page_unpack(p, scratch, packed_size, page);
+}
+
+// Positional reads and writes never touch the shared file offset, so they need no seek and no locking around it
+bool file_try_read_at(int fd, void* buffer, size_t size, u64 offset, size_t* read)
+{
+    size_t total = 0;
+    while (total < size) {
+#ifdef PLATFORM_WINDOWS
+        i64 result = -1;
+        if (_lseeki64(fd, (i64)(offset + total), SEEK_SET) >= 0) {
+            result = _read(fd, (u8*)buffer + total, (unsigned)(size - total));
+        }
+#else
+        ssize_t result = pread(fd, (u8*)buffer + total, size - total, (off_t)(offset + total));
+#endif
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *read = total;
+            return false;
+        }
+        if (result == 0) {
+            // End of file
+            break;
+        }
+        total += result;
+    }
+    *read = total;
+    return true;
+}
+
+size_t file_read_at(int fd, void* buffer, size_t size, u64 offset)
+{
+    size_t read;
+    if (!file_try_read_at(fd, buffer, size, offset, &read)) {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return read;
+}
+
+/*
+    A compressed frame usually fits in its slot's first block and the rest of the slot is a hole, so
+    with compression pages are read in two steps: that block first, then whatever more of the slot
+    the page turns out to need. Anything else is read whole in one go.
+*/
+u32 pager_first_read_size(Pager* p, u32 page_num)
+{
+    bool may_be_frame = p->compress_pages && page_num != 0 && p->page_size > PAGE_FRAME_BLOCK_SIZE;
+    return may_be_frame ? PAGE_FRAME_BLOCK_SIZE : p->page_size;
+}
+
+/*
+    Reads the rest of a page whose first read bytes are in memory and decodes it. scratch is for
+    pager_decode_page. Adds the extra bytes read to bytes_read.
+*/
+PageReadResult pager_try_complete_read(Pager* p, u32 page_num, void* page, size_t read, u8* scratch, size_t* bytes_read)
+{
+    size_t needed = p->page_size;
+    if (read >= PAGE_FRAME_HEADER_SIZE && pager_first_read_size(p, page_num) < p->page_size &&
+        *page_frame_magic(page) == PAGE_FRAME_MAGIC &&
+        *page_frame_compressed_size(page) <= p->page_size - PAGE_FRAME_HEADER_SIZE) {
+        needed = PAGE_FRAME_HEADER_SIZE + *page_frame_compressed_size(page);
+    }
+    if (needed > read) {
+        size_t extra;
+        bool ok = file_try_read_at(p->file_descriptor, (u8*)page + read, needed - read,
+                                   (u64)page_num * p->page_size + read, &extra);
+        *bytes_read += extra;
+        if (!ok) {
+            return PAGE_READ_IO_ERROR;
+        }
+    }
+    return pager_decode_page(p, page_num, page, scratch) ? PAGE_READ_OK : PAGE_READ_CORRUPT;
+}
+
+// Exits on anything but PAGE_READ_OK, for the paths that cannot go on without the page
+void pager_require_page_read(PageReadResult result, u32 page_num)
+{
+    switch (result) {
+        case PAGE_READ_OK:
+            return;
+        case PAGE_READ_IO_ERROR:
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        case PAGE_READ_CORRUPT:
+            printf("Corrupt compressed page %u.\n", page_num);
+            exit(EXIT_FAILURE);
+    }
+}
+
+size_t pager_complete_read(Pager* p, u32 page_num, void* page, size_t read, u8* scratch)
+{
+    size_t extra = 0;
+    pager_require_page_read(pager_try_complete_read(p, page_num, page, read, scratch, &extra), page_num);
+    return extra;
+}
+
+void pager_finish_read(Pager* p, u32 page_num)
+{
+    PageIoRequest* r = &p->reads[page_num];
+    page_io_wait(p->io, r);
+    if (r->result < 0) {
+        printf("Error reading file: %d\n", (i32)-r->result);
+        exit(EXIT_FAILURE);
+    }
+    p->stats.bytes_read += r->result;
+    p->stats.bytes_read += pager_complete_read(p, page_num, r->buffer, r->result, p->packed_buffer);
+    p->reading[page_num] = false;
+}
+
+/*
+    Reads a page from its slot in the file and adds the bytes read to bytes_read. It leaves the cache
+    alone and never exits, so threads with their own page and scratch buffers may call it at the same
+    time and the integrity check can report pages it cannot read.
+*/
+PageReadResult pager_try_read_page(Pager* p, u32 page_num, void* page, u8* scratch, size_t* bytes_read)
+{
+    size_t read;
+    bool ok = file_try_read_at(p->file_descriptor, page, pager_first_read_size(p, page_num),
+                               (u64)page_num * p->page_size, &read);
+    *bytes_read += read;
+    if (!ok) {
+        return PAGE_READ_IO_ERROR;
+    }
+    return pager_try_complete_read(p, page_num, page, read, scratch, bytes_read);
+}
+
+// Reads a page from its slot in the file, returns the number of bytes read
+size_t pager_read_page(Pager* p, u32 page_num, void* page, u8* scratch)
+{
+    size_t bytes_read = 0;
+    pager_require_page_read(pager_try_read_page(p, page_num, page, scratch, &bytes_read), page_num);
+    return bytes_read;
+}
+
+void pager_mark_dirty(Pager* p, u32 page_num)
+{
+    p->dirty[page_num] = true;
+}
+
+// Starts reading a page in the background if it is on disk and not cached yet. Call page_io_kick after a batch
+void pager_prefetch(Pager* p, u32 page_num)
+{
+    if (page_num >= TABLE_MAX_PAGES || p->pages[page_num] || (u64)page_num * p->page_size >= p->file_length) {
+        return;
+    }
+    void* page = frame_arena_alloc(&p->frames);
+    assert(page && "Ran out of page frames");
+
+    PageIoRequest* r = &p->reads[page_num];
+    r->fd = p->file_descriptor;
+    r->is_write = false;
+    r->buffer = page;
+    r->size = pager_first_read_size(p, page_num);
+    r->offset = (u64)page_num * p->page_size;
+    page_io_submit(p->io, r);
+
+    p->pages[page_num] = page;
+    p->reading[page_num] = true;
+    p->stats.pages_prefetched++;
+}
+
+void* get_page(Pager* p, u32 page_num)
+{
+    if (page_num >= TABLE_MAX_PAGES) {
+        printf("Tried to fetch a page out of bounds. %u > %u\n", page_num, TABLE_MAX_PAGES);
+        exit(EXIT_FAILURE);
+    }
+
+    if (p->pages[page_num]) {
+        if (p->reading[page_num]) {
+            pager_finish_read(p, page_num);
+        }
+        p->stats.cache_hits++;
+        return p->pages[page_num];
+    }
+
+    // Cache miss, must read from file
+    p->stats.cache_misses++;
+    void* page = frame_arena_alloc(&p->frames);
+    assert(page && "Ran out of page frames");
+    u64 num_pages = p->file_length / p->page_size;
+    if (p->file_length % p->page_size) {
+        num_pages += 1;
+    }
+
+    if (page_num < num_pages) {
+        p->stats.bytes_read += pager_read_page(p, page_num, page, p->packed_buffer);
+    } else {
+        // Brand new page, it only exists in memory until it gets flushed
+        p->dirty[page_num] = true;
+    }
+
+    p->pages[page_num] = page;
+    if (page_num >= p->pages_count) {
+        p->pages_count = page_num + 1;
+    }
+
+    return page;
+}
+
+u32 get_unused_page_num(Pager* p)
+{
+    // Until we start recycling free pages,
+    // new pages will always go onto the end of the database file
+    return p->pages_count;
+}
+
+Key get_node_max_key(Pager* p, void* node)
+{
+    if (get_node_type(node) == NODE_LEAF) {
+        return key_load(p, leaf_node_key(p, node, *leaf_node_cells_count(node) - 1));
+    }
+    void* right_child = get_page(p, *internal_node_right_child(node));
+    return get_node_max_key(p, right_child);
+}
+
+void print_constants(Pager* p)
+{
+    printf("Constants:\n");
+    printf("ROW_SIZE: %u\n", p->row_size);
+    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_CELL_SIZE: %d\n", p->leaf_node_cell_size);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", p->leaf_node_space_for_cells);
+    printf("LEAF_NODE_MAX_CELLS: %d\n", p->leaf_node_max_cells);
+}
+
+const char* statement_type_name(StatementType type)
+{
+    switch (type) {
+        case STATEMENT_INSERT: return "insert";
+        case STATEMENT_SELECT: return "select";
+        case STATEMENT_UPDATE: return "update";
+        default:
+            assert(false && "Invalid statement type in statement_type_name");
+            return "unknown";
+    }
+}
+
+u64 now_ns()
+{
+    struct timespec ts;
+#ifdef PLATFORM_WINDOWS
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+void latency_histogram_record(LatencyHistogram* h, u64 ns)
+{
+    u32 bucket = 0;
+    while (bucket < LATENCY_BUCKETS_COUNT - 1 && (ns >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    h->buckets[bucket]++;
+    h->count++;
+    h->total_ns += ns;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+// Returns the upper bound of the bucket holding the given percentile, so the result is accurate to a power of two
+u64 latency_histogram_percentile(LatencyHistogram* h, u32 percentile)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+    u64 rank = (h->count * percentile + 99) / 100;
+    u64 seen = 0;
+    for (u32 i = 0; i < LATENCY_BUCKETS_COUNT; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            u64 upper = (2ull << i) - 1;
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+u32 pager_dirty_pages_count(Pager* p)
+{
+    u32 count = 0;
+    for (u32 i = 0; i < TABLE_MAX_PAGES; i++) {
+        count += p->dirty[i];
+    }
+    return count;
+}
+
+void print_stats(Table* t)
+{
+    PagerStats* ps = &t->pager->stats;
+    printf("Stats:\n");
+    printf("page_cache_hits: %llu\n", (unsigned long long)ps->cache_hits);
+    printf("page_cache_misses: %llu\n", (unsigned long long)ps->cache_misses);
+    printf("bytes_read: %llu\n", (unsigned long long)ps->bytes_read);
+    printf("bytes_written: %llu\n", (unsigned long long)ps->bytes_written);
+    printf("pages_flushed: %llu\n", (unsigned long long)ps->pages_flushed);
+    printf("pages_prefetched: %llu\n", (unsigned long long)ps->pages_prefetched);
+    printf("dirty_pages: %u\n", pager_dirty_pages_count(t->pager));
+    printf("page_io: %s\n", page_io_backend_name(page_io_backend(t->pager->io)));
+    printf("page_frames: %u of %u (%s)\n", t->pager->frames.frames_allocated, t->pager->frames.frames_capacity,
+           frame_arena_backing_name(t->pager->frames.backing));
+    printf("leaf_splits: %llu\n", (unsigned long long)t->stats.leaf_splits);
+    printf("internal_splits: %llu\n", (unsigned long long)t->stats.internal_splits);
+    printf("root_splits: %llu\n", (unsigned long long)t->stats.root_splits);
+    printf("sort_runs_spilled: %llu\n", (unsigned long long)t->stats.sort_runs_spilled);
+    printf("bloom_filter_skips: %llu\n", (unsigned long long)t->stats.bloom_filter_skips);
+    printf("rightmost_appends: %llu\n", (unsigned long long)t->stats.rightmost_appends);
+    printf("row_cache: %u of %u rows, %llu hits, %llu misses, %llu evictions\n", t->row_cache.entries_count,
+           t->row_cache.max_entries, (unsigned long long)t->row_cache.hits, (unsigned long long)t->row_cache.misses,
+           (unsigned long long)t->row_cache.evictions);
+    for (u32 i = 0; i < STATEMENT_TYPES_COUNT; i++) {
+        LatencyHistogram* h = &t->stats.statement_latency[i];
+        printf("%s: count %llu", statement_type_name((StatementType)i), (unsigned long long)h->count);
+        if (h->count > 0) {
+            printf(", avg %lluns, p50 %lluns, p90 %lluns, p99 %lluns, max %lluns",
+                   (unsigned long long)(h->total_ns / h->count),
+                   (unsigned long long)latency_histogram_percentile(h, 50),
+                   (unsigned long long)latency_histogram_percentile(h, 90),
+                   (unsigned long long)latency_histogram_percentile(h, 99),
+                   (unsigned long long)h->max_ns);
+        }
+        printf("\n");
+    }
+}
+
+// Single line JSON dump meant to be scraped, histograms are emitted raw so they can be merged across processes
+void print_stats_json(Table* t)
+{
+    PagerStats* ps = &t->pager->stats;
+    printf("{\"page_cache_hits\":%llu,\"page_cache_misses\":%llu,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+           "\"pages_flushed\":%llu,\"pages_prefetched\":%llu,\"leaf_splits\":%llu,\"internal_splits\":%llu,\"root_splits\":%llu,\"sort_runs_spilled\":%llu,\"bloom_filter_skips\":%llu,\"rightmost_appends\":%llu,"
+           "\"row_cache_hits\":%llu,\"row_cache_misses\":%llu,\"row_cache_evictions\":%llu,"
+           "\"statements\":{",
+           (unsigned long long)ps->cache_hits, (unsigned long long)ps->cache_misses,
+           (unsigned long long)ps->bytes_read, (unsigned long long)ps->bytes_written,
+           (unsigned long long)ps->pages_flushed, (unsigned long long)ps->pages_prefetched,
+           (unsigned long long)t->stats.leaf_splits,
+           (unsigned long long)t->stats.internal_splits, (unsigned long long)t->stats.root_splits,
+           (unsigned long long)t->stats.sort_runs_spilled, (unsigned long long)t->stats.bloom_filter_skips,
+           (unsigned long long)t->stats.rightmost_appends, (unsigned long long)t->row_cache.hits,
+           (unsigned long long)t->row_cache.misses, (unsigned long long)t->row_cache.evictions);
+    for (u32 i = 0; i < STATEMENT_TYPES_COUNT; i++) {
+        LatencyHistogram* h = &t->stats.statement_latency[i];
+        printf("%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"max_ns\":%llu,\"buckets\":[",
+               i > 0 ? "," : "", statement_type_name((StatementType)i), (unsigned long long)h->count,
+               (unsigned long long)h->total_ns, (unsigned long long)h->max_ns);
+        for (u32 j = 0; j < LATENCY_BUCKETS_COUNT; j++) {
+            printf("%s%llu", j > 0 ? "," : "", (unsigned long long)h->buckets[j]);
+        }
+        printf("]}");
+    }
+    printf("}}\n");
+}
+
+void reset_stats(Table* t)
+{
+    memset(&t->pager->stats, 0, sizeof(t->pager->stats));
+    memset(&t->stats, 0, sizeof(t->stats));
+    t->row_cache.hits = 0;
+    t->row_cache.misses = 0;
+    t->row_cache.evictions = 0;
+}
+
+void indent(u32 level)
+{
+    for (u32 i = 0; i < level; i++)
+        printf("  ");
+}
+
+void print_tree(Pager* p, u32 page_num, u32 indentation_level)
+{
+    void* node = get_page(p, page_num);
+    u32 keys_count, child;
+
+    switch (get_node_type(node)) {
+        case NODE_INTERNAL:
+        {
+            keys_count = *internal_node_keys_count(node);
+            indent(indentation_level);
+            printf("- internal (size %u)\n", keys_count);
+            if (keys_count > 0) {
+                for (u32 i = 0; i < keys_count; i++) {
+                    child = *internal_node_child(p, node, i);
+                    print_tree(p, child, indentation_level + 1);
+                    indent(indentation_level + 1);
+                    printf("- key ");
+                    print_key(p, key_load(p, internal_node_key(p, node, i)));
+                    printf("\n");
+                }
+            }
+            child = *internal_node_right_child(node);
+            print_tree(p, child, indentation_level + 1);
+            break;
+        }
+        case NODE_LEAF:
+        {
+            keys_count = *leaf_node_cells_count(node);
+            indent(indentation_level);
+            printf("- leaf (size %u)\n", keys_count);
+            for (u32 i = 0; i < keys_count; i++) {
+                indent(indentation_level + 1);
+                printf("- ");
+                print_key(p, key_load(p, leaf_node_key(p, node, i)));
+                printf("\n");
+            }
+            break;
+        }
+        default:
+            printf("Invalid node type %d\n", get_node_type(node));
+            exit(EXECUTE_FAILURE);
+    }
+}
+
+void print_row(Pager* p, Row* r)
+{
+    printf("(");
+    print_key(p, r->key);
+    printf(", %s, %s)\n", r->username, r->email);
+}
+
+void serialize_row(Pager* p, Row* r, void* dst)
+{
+    assert(r && dst && "Must provide valid ptrs to serialize_row");
+    key_store(p, dst + KEY_OFFSET, r->key);
+    strncpy(dst + row_username_offset(p), (const char*)&r->username, USERNAME_SIZE);
+    strncpy(dst + row_email_offset(p), (const char*)&r->email, EMAIL_SIZE);
+}
+
+void deserialize_row(Pager* p, void* src, Row* r)
+{
+    assert(src && r && "Must provide valid ptrs to deserialize_row");
+    r->key = key_load(p, src + KEY_OFFSET);
+    memcpy(&r->username, src + row_username_offset(p), USERNAME_SIZE);
+    memcpy(&r->email, src + row_email_offset(p), EMAIL_SIZE);
+}
+
+void update_internal_node_key(Pager* p, void* node, Key old_key, Key new_key)
+{
+    u32 old_child_index = internal_node_find_child(p, node, old_key);
+    // The right child has no key of its own, its largest key is the node's
+    if (old_child_index < *internal_node_keys_count(node)) {
+        key_store(p, internal_node_key(p, node, old_child_index), new_key);
+    }
+}
+
+// splitmix64 finalizer over both key halves, good enough to drive the Bloom filter probes
+u64 key_hash(Key key)
+{
+    u64 h = key.id ^ (key.tenant * 0x9e3779b97f4a7c15ull);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+void leaf_filter_rebuild(Table* t, u32 page_num)
+{
+    if (!t->leaf_filters_built) {
+        return;
+    }
+    void* node = get_page(t->pager, page_num);
+    bloom_filters_reset(&t->leaf_filters, page_num);
+    u32 cells_count = *leaf_node_cells_count(node);
+    for (u32 i = 0; i < cells_count; i++) {
+        Key key = key_load(t->pager, leaf_node_key(t->pager, node, i));
+        bloom_filters_add(&t->leaf_filters, page_num, key_hash(key));
+    }
+}
+
+void leaf_filters_build(Table* t, u32 page_num)
+{
+    void* node = get_page(t->pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        leaf_filter_rebuild(t, page_num);
+        return;
+    }
+    u32 keys_count = *internal_node_keys_count(node);
+    for (u32 i = 0; i <= keys_count; i++) {
+        leaf_filters_build(t, *internal_node_child(t->pager, node, i));
+    }
+}
+
+void create_new_root(Table* t, u32 right_child_page_num)
+{
+    /*
+        Handle splitting the root.
+        Old root copied to new page, becomes left child.
+        Address of right child passed in.
+        Re-initialize root page to contain the new root node.
+        New root node points to two children.
+    */
+    t->stats.root_splits++;
+    void* root = get_page(t->pager, t->root_page_num);
+    void* right_child = get_page(t->pager, right_child_page_num);
+    u32 left_child_page_num = get_unused_page_num(t->pager);
+    void* left_child = get_page(t->pager, left_child_page_num);
+    pager_mark_dirty(t->pager, t->root_page_num);
+    pager_mark_dirty(t->pager, right_child_page_num);
+    pager_mark_dirty(t->pager, left_child_page_num);
+
+    if (get_node_type(root) == NODE_INTERNAL) {
+        initialize_internal_node(right_child);
+        initialize_internal_node(left_child);
+    }
+
+    // Left child has data copied from old root
+    memcpy(left_child, root, t->pager->page_size);
+    set_node_root(left_child, false);
+
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+        void* child;
+        for (i32 i = 0; i < *internal_node_keys_count(left_child); i++) {
+            child = get_page(t->pager, *internal_node_child(t->pager, left_child, i));
+            *node_parent(child) = left_child_page_num;
+            pager_mark_dirty(t->pager, *internal_node_child(t->pager, left_child, i));
+        }
+        child = get_page(t->pager, *internal_node_right_child(left_child));
+        *node_parent(child) = left_child_page_num;
+        pager_mark_dirty(t->pager, *internal_node_right_child(left_child));
+    }
+
+    // Root node is a new internal node with one key and two children
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_keys_count(root) = 1;
+    *internal_node_child(t->pager, root, 0) = left_child_page_num;
+    Key left_child_max_key = get_node_max_key(t->pager, left_child);
+    key_store(t->pager, internal_node_key(t->pager, root, 0), left_child_max_key);
+    *internal_node_right_child(root) = right_child_page_num;
+    *node_parent(left_child) = t->root_page_num;
+    *node_parent(right_child) = t->root_page_num;
+}
+
+void internal_node_split_insert(Table* t, u32 parent_page_num, u32 child_page_num);
+
+void internal_node_insert(Table* t, u32 parent_page_num, u32 child_page_num)
+{
+    // Add a new child/key pair to parent that corresponds to child
+    void* parent = get_page(t->pager, parent_page_num);
+    void* child = get_page(t->pager, child_page_num);
+    Key child_max_key = get_node_max_key(t->pager, child);
+    u32 index = internal_node_find_child(t->pager, parent, child_max_key);
+
+    u32 original_keys_count = *internal_node_keys_count(parent);
+
+    if (original_keys_count >= INTERNAL_NODE_MAX_CELLS) {
+        internal_node_split_insert(t, parent_page_num, child_page_num);
+        return;
+    }
+    pager_mark_dirty(t->pager, parent_page_num);
+
+    u32 right_child_page_num = *internal_node_right_child(parent);
+    // An internal node with a right child of INVALID_PAGE_NUM is empty
+    if (right_child_page_num == INVALID_PAGE_NUM) {
+        *internal_node_right_child(parent) = child_page_num;
+        return;
+    }
+
+    void* right_child = get_page(t->pager, right_child_page_num);
+    /*
+        If we are already at the max number of cells for a node, we cannot increment
+        before splitting. Incrementing without inserting a new key/child pair
+        and immediately calling internal_node_split_and_insert has the effect
+        of creating a new key at (max_cells + 1) with an uninitialized value
+    */
+    *internal_node_keys_count(parent) = original_keys_count + 1;
+
+    if (key_compare(child_max_key, get_node_max_key(t->pager, right_child)) > 0) {
+        // Replace right child
+        *internal_node_child(t->pager, parent, original_keys_count) = right_child_page_num;
+        key_store(t->pager, internal_node_key(t->pager, parent, original_keys_count), get_node_max_key(t->pager, right_child));
+        *internal_node_right_child(parent) = child_page_num;
+    } else {
+        // Make room for the new cell
+        for (u32 i = original_keys_count; i > index; i--) {
+            void* dst = internal_node_cell(t->pager, parent, i);
+            void* src = internal_node_cell(t->pager, parent, i - 1);
+            memcpy(dst, src, t->pager->internal_node_cell_size);
+        }
+        *internal_node_child(t->pager, parent, index) = child_page_num;
+        key_store(t->pager, internal_node_key(t->pager, parent, index), child_max_key);
+    }
+}
+
+/*
+    Splits a full internal node while adding child_page_num to it. The node's children and the new one
+    are gathered in key order, the lower half stays in the node and the upper half moves to a new
+    node, and every moved child gets its parent pointer rewritten. Separators are taken from the
+    node's own keys, which always equal their child's largest key. Only the right child, which has
+    no separator, and the new child have their largest key looked up. Splitting the root first moves
+    its contents to a new left child so the root keeps its page.
+*/
+void internal_node_split_insert(Table* t, u32 parent_page_num, u32 child_page_num)
+{
+    Pager* p = t->pager;
+    t->stats.internal_splits++;
+    u32 old_page_num = parent_page_num;
+    void* old_node = get_page(p, old_page_num);
+    u32 new_page_num = get_unused_page_num(p);
+    bool splitting_root = is_node_root(old_node);
+    if (splitting_root) {
+        create_new_root(t, new_page_num);
+        void* root = get_page(p, t->root_page_num);
+        old_page_num = *internal_node_child(p, root, 0);
+        old_node = get_page(p, old_page_num);
+    }
+    void* new_node = get_page(p, new_page_num);
+    if (!splitting_root) {
+        // create_new_root already set up the new node as the root's right child
+        initialize_internal_node(new_node);
+    }
+    pager_mark_dirty(p, old_page_num);
+    pager_mark_dirty(p, new_page_num);
+
+    u32 keys_count = *internal_node_keys_count(old_node);
+    u32 children_count = keys_count + 2;
+    u32 children[children_count];
+    Key keys[children_count];
+    for (u32 i = 0; i < keys_count; i++) {
+        children[i] = *internal_node_child(p, old_node, i);
+        keys[i] = key_load(p, internal_node_key(p, old_node, i));
+    }
+    children[keys_count] = *internal_node_right_child(old_node);
+    keys[keys_count] = get_node_max_key(p, get_page(p, children[keys_count]));
+
+    Key child_max = get_node_max_key(p, get_page(p, child_page_num));
+    u32 index = keys_count + 1;
+    while (index > 0 && key_compare(child_max, keys[index - 1]) < 0) {
+        children[index] = children[index - 1];
+        keys[index] = keys[index - 1];
+        index--;
+    }
+    children[index] = child_page_num;
+    keys[index] = child_max;
+
+    // The lower half of the old children stays, plus the new child when it sorts among them
+    u32 left_count = INTERNAL_NODE_MAX_CELLS / 2 + 1 + (index <= INTERNAL_NODE_MAX_CELLS / 2 ? 1 : 0);
+    // Both halves end with a child that becomes their right child and drops its separator
+    void* halves[2] = {old_node, new_node};
+    u32 half_page_nums[2] = {old_page_num, new_page_num};
+    u32 first[2] = {0, left_count};
+    u32 count[2] = {left_count, children_count - left_count};
+    for (u32 h = 0; h < 2; h++) {
+        void* node = halves[h];
+        *internal_node_keys_count(node) = count[h] - 1;
+        for (u32 i = 0; i < count[h]; i++) {
+            u32 child = children[first[h] + i];
+            if (i + 1 < count[h]) {
+                *internal_node_cell(p, node, i) = child;
+                key_store(p, internal_node_key(p, node, i), keys[first[h] + i]);
+            } else {
+                *internal_node_right_child(node) = child;
+            }
+            *node_parent(get_page(p, child)) = half_page_nums[h];
+            pager_mark_dirty(p, child);
+        }
+    }
+    Key left_max = keys[left_count - 1];
+
+    if (splitting_root) {
+        // create_new_root already made the two halves the root's only children
+        key_store(p, internal_node_key(p, get_page(p, t->root_page_num), 0), left_max);
+        return;
+    }
+
+    u32 grandparent_page_num = *node_parent(old_node);
+    void* grandparent = get_page(p, grandparent_page_num);
+    pager_mark_dirty(p, grandparent_page_num);
+    u32 grandparent_keys_count = *internal_node_keys_count(grandparent);
+    for (u32 i = 0; i < grandparent_keys_count; i++) {
+        if (*internal_node_child(p, grandparent, i) == old_page_num) {
+            key_store(p, internal_node_key(p, grandparent, i), left_max);
+        }
+    }
+    // Set before inserting, a split of the grandparent may move the new node again
+    *node_parent(new_node) = grandparent_page_num;
+    internal_node_insert(t, grandparent_page_num, new_page_num);
+}
+
+void leaf_node_split_insert(Cursor c, Key key, Row* value)
+{
+    /*
+        Create a new node and move half the cells over.
+        Insert the new value in one of the two nodes.
+        Update parent or create a new parent.
+    */
+    c.table->stats.leaf_splits++;
+    Pager* p = c.table->pager;
+    void* old_node = get_page(c.table->pager, c.page_num);
+    Key old_max = get_node_max_key(c.table->pager, old_node);
+
+    /*
+        Appending past the end of the rightmost leaf means keys are arriving in order. An even split
+        would leave the left node half empty forever, so keep it full and start the new node with
+        just the new key instead.
+    */
+    u32 left_split_count = p->leaf_node_left_split_count;
+    u32 right_split_count = p->leaf_node_right_split_count;
+    bool appending = c.cell_num == p->leaf_node_max_cells && *leaf_node_next_leaf(old_node) == 0;
+    if (appending) {
+        left_split_count = p->leaf_node_max_cells;
+        right_split_count = 1;
+    }
+
+    u32 new_page_num = get_unused_page_num(c.table->pager);
+    void* new_node = get_page(c.table->pager, new_page_num);
+    pager_mark_dirty(c.table->pager, c.page_num);
+    pager_mark_dirty(c.table->pager, new_page_num);
+    initialize_leaf_node(new_node);
+    *node_parent(new_node) = *node_parent(old_node);
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+
+    /*
+        All existing keys plus new key should be divided
+        between old (left) and new (right) nodes.
+        Starting from the right, move each key to correct position.
+    */
+    for (i32 i = p->leaf_node_max_cells; i >= 0; i--) {
+        void* dst_node = i >= left_split_count ? new_node : old_node;
+        u32 index_within_node = i >= left_split_count ? i - left_split_count : i;
+        void* dst = leaf_node_cell(p, dst_node, index_within_node);
+
+        if (i == c.cell_num) {
+            serialize_row(p, value, leaf_node_value(p, dst_node, index_within_node));
+            key_store(p, leaf_node_key(p, dst_node, index_within_node), key);
+        } else if (i > c.cell_num) {
+            memcpy(dst, leaf_node_cell(p, old_node, i - 1), p->leaf_node_cell_size);
+        } else {
+            memcpy(dst, leaf_node_cell(p, old_node, i), p->leaf_node_cell_size);
+        }
+    }
+
+    // Update cell count on both leaf nodes
+    *leaf_node_cells_count(old_node) = left_split_count;
+    *leaf_node_cells_count(new_node) = right_split_count;
+    if (c.page_num == c.table->rightmost_leaf_page_num) {
+        c.table->rightmost_leaf_page_num = new_page_num;
+    }
+
+    leaf_filter_rebuild(c.table, new_page_num);
+    if (is_node_root(old_node)) {
+        // The old root's cells move to a new left child and the root page turns into an internal node
+        create_new_root(c.table, new_page_num);
+        void* root = get_page(c.table->pager, c.table->root_page_num);
+        if (c.table->leaf_filters_built) {
+            bloom_filters_deactivate(&c.table->leaf_filters, c.table->root_page_num);
+            leaf_filter_rebuild(c.table, *internal_node_child(c.table->pager, root, 0));
+        }
+        return;
+    }
+    leaf_filter_rebuild(c.table, c.page_num);
+
+    u32 parent_page_num = *node_parent(old_node);
+    Key new_max = get_node_max_key(c.table->pager, old_node);
+    void* parent = get_page(c.table->pager, parent_page_num);
+    pager_mark_dirty(c.table->pager, parent_page_num);
+
+    update_internal_node_key(c.table->pager, parent, old_max, new_max);
+    internal_node_insert(c.table, parent_page_num, new_page_num);
+}
+
+void leaf_node_insert(Cursor c, Key key, Row* value)
+{
+    Pager* p = c.table->pager;
+    void* node = get_page(c.table->pager, c.page_num);
+    u32 cells_count = *leaf_node_cells_count(node);
+    if (cells_count >= c.table->pager->leaf_node_max_cells) {
+        // Node full
+        leaf_node_split_insert(c, key, value);
+        return;
+    }
+    pager_mark_dirty(c.table->pager, c.page_num);
+
+    if (c.cell_num < cells_count) {
+        // Make room for new cell
+        for (u32 i = cells_count; i > c.cell_num; i--) {
+            memcpy(leaf_node_cell(p, node, i), leaf_node_cell(p, node, i - 1),
+                   p->leaf_node_cell_size);
+        }
+    }
+
+    *leaf_node_cells_count(node) += 1;
+    key_store(p, leaf_node_key(p, node, c.cell_num), key);
+    serialize_row(p, value, leaf_node_value(p, node, c.cell_num));
+    if (c.table->leaf_filters_built) {
+        bloom_filters_add(&c.table->leaf_filters, c.page_num, key_hash(key));
+    }
+}
+
+Cursor leaf_node_find(Table* t, u32 page_num, Key key)
+{
+    void* node = get_page(t->pager, page_num);
+    bool found;
+
+    Cursor cursor = {
+        .table = t,
+        .page_num = page_num,
+        .cell_num = leaf_node_search(t->pager, node, key, &found),
+    };
+    return cursor;
+}
+
+Cursor internal_node_find(Table* t, u32 page_num, Key key)
+{
+    void* node = get_page(t->pager, page_num);
+
+    u32 child_index = internal_node_find_child(t->pager, node, key);
+    u32 child_num = *internal_node_child(t->pager, node, child_index);
+    void* child = get_page(t->pager, child_num);
+    switch (get_node_type(child)) {
+        case NODE_INTERNAL:
+            return internal_node_find(t, child_num, key);
+        case NODE_LEAF:
+            return leaf_node_find(t, child_num, key);
+        default:
+            printf("Invalid node type %d\n", get_node_type(node));
+            exit(EXECUTE_FAILURE);
+    }
+}
+
+// Returns the position of the given key. If the key is not present,
+// returns the position where it should be inserted.
+Cursor table_find(Table* t, Key key)
+{
+    void* root_node = get_page(t->pager, t->root_page_num);
+    if (get_node_type(root_node) == NODE_LEAF) {
+        return leaf_node_find(t, t->root_page_num, key);
+    }
+
+    return internal_node_find(t, t->root_page_num, key);
+}
+
+// Descends to the leaf that would hold the key. An active filter marks a leaf, which is then not read
+u32 table_find_leaf_page(Table* t, Key key)
+{
+    u32 page_num = t->root_page_num;
+    for (;;) {
+        if (t->leaf_filters_built && bloom_filters_is_active(&t->leaf_filters, page_num)) {
+            return page_num;
+        }
+        void* node = get_page(t->pager, page_num);
+        if (get_node_type(node) == NODE_LEAF) {
+            return page_num;
+        }
+        page_num = *internal_node_child(t->pager, node, internal_node_find_child(t->pager, node, key));
+    }
+}
+
+/*
+    Finds the key's position like table_find, in the same single descent. Once the descent reaches the
+    leaf its filter is asked first, and a key that is definitely not in the table returns false without
+    reading the leaf or setting cursor.
+*/
+bool table_find_existing(Table* t, Key key, Cursor* cursor)
+{
+    if (t->use_leaf_filters && !t->leaf_filters_built) {
+        t->leaf_filters_built = true;
+        leaf_filters_build(t, t->root_page_num);
+    }
+    u32 page_num = table_find_leaf_page(t, key);
+    if (t->use_leaf_filters && !bloom_filters_may_contain(&t->leaf_filters, page_num, key_hash(key))) {
+        t->stats.bloom_filter_skips++;
+        return false;
+    }
+    *cursor = leaf_node_find(t, page_num, key);
+    return true;
+}
+
+// Queues the leftmost leaves of the subtree at page_num, which sits height levels above the leaves. Returns how many
+u32 prefetch_subtree_leaves(Table* t, u32 page_num, u32 height, u32 budget)
+{
+    if (height == 0) {
+        pager_prefetch(t->pager, page_num);
+        return 1;
+    }
+    // Internal nodes are few and almost always cached, only leaves are worth reading in the background
+    void* node = get_page(t->pager, page_num);
+    u32 keys_count = *internal_node_keys_count(node);
+    u32 queued = 0;
+    for (u32 i = 0; i <= keys_count && queued < budget; i++) {
+        queued += prefetch_subtree_leaves(t, *internal_node_child(t->pager, node, i), height - 1, budget - queued);
+    }
+    return queued;
+}
+
+/*
+    Queues reads for the PAGE_PREFETCH_DEPTH leaves that follow leaf_page_num in key order. Siblings
+    under the same parent come first, then the walk moves up one ancestor at a time and descends into
+    the subtrees to its right, so the window keeps going across parent boundaries. Leaves that are
+    already cached still count towards the window.
+*/
+void prefetch_next_leaves(Table* t, u32 leaf_page_num)
+{
+    u32 page_num = leaf_page_num;
+    u32 height = 0;
+    u32 queued = 0;
+    while (queued < PAGE_PREFETCH_DEPTH) {
+        void* node = get_page(t->pager, page_num);
+        if (is_node_root(node)) {
+            break;
+        }
+        u32 parent_page_num = *node_parent(node);
+        void* parent = get_page(t->pager, parent_page_num);
+        u32 keys_count = *internal_node_keys_count(parent);
+        u32 i = 0;
+        while (i <= keys_count && *internal_node_child(t->pager, parent, i) != page_num) {
+            i++;
+        }
+        for (i++; i <= keys_count && queued < PAGE_PREFETCH_DEPTH; i++) {
+            queued += prefetch_subtree_leaves(t, *internal_node_child(t->pager, parent, i), height,
+                                              PAGE_PREFETCH_DEPTH - queued);
+        }
+        page_num = parent_page_num;
+        height++;
+    }
+    page_io_kick(t->pager->io);
+}
+
+Cursor table_start(Table* t)
+{
+    Cursor cursor = table_find(t, (Key){0});
+    void* node = get_page(t->pager, cursor.page_num);
+    u32 cells_count = *leaf_node_cells_count(node);
+    cursor.end_of_table = cells_count == 0;
+    prefetch_next_leaves(t, cursor.page_num);
+    return cursor;
+}
+
+void cursor_advance(Cursor* c)
+{
+    void* node = get_page(c->table->pager, c->page_num);
+    c->cell_num += 1;
+    if (c->cell_num >= *leaf_node_cells_count(node)) {
+        // Advance to next leaf node
+        u32 next_page_num = *leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            // Rightmost leaf (end)
+            c->end_of_table = true;
+        } else {
+            c->page_num = next_page_num;
+            c->cell_num = 0;
+            prefetch_next_leaves(c->table, next_page_num);
+        }
+    }
+}
+
+void* cursor_value(Cursor c)
+{
+    u32 page_num = c.page_num;
+    void* page = get_page(c.table->pager, page_num);
+    return leaf_node_value(c.table->pager, page, c.cell_num);
+}
+
+/*
+    Integrity check. The top levels of the tree are walked on the calling thread until there are
+    enough subtrees to keep every thread busy, then worker threads take subtrees one at a time and
+    check everything under them. Cached pages are read where they are, since the cache does not
+    change while the check runs, and all other pages are read straight from the file into the
+    worker's own buffers. What spans subtrees is checked at the end: separators against the
+    largest key below them, the leaf chain and pages nobody reached.
+*/
+#define CHECK_MAX_THREADS 8
+#define CHECK_TASKS_PER_THREAD 4
+// Each level needs its own page buffer. Far more than 100 pages can make, so hitting it means a bad tree
+#define CHECK_MAX_HEIGHT 32
+#define CHECK_MAX_ERRORS_PRINTED 20
+
+typedef struct {
+    u32 page_num;
+    u32 next_leaf;
+} CheckLeaf;
+
+typedef struct {
+    CheckLeaf* data;
+    size_t count;
+    size_t capacity;
+} CheckLeaves;
+
+typedef struct {
+    u32 page_num;
+    u32 parent_page_num;
+    u32 depth;
+    bool has_lower;
+    Key lower;
+    bool has_upper;
+    Key upper;
+    // The subtree a task was split off from, -1 for the root. Splitting appends a task's children together
+    i32 parent_task;
+    bool split;
+    u32 first_child_task;
+    u32 children_count;
+
+    // Results, merged once every task is done
+    bool has_keys;
+    Key max_key;
+    CheckLeaves leaves;
+    u32 min_leaf_depth;
+    u32 max_leaf_depth;
+    u64 leaf_pages;
+    u64 internal_pages;
+    u64 rows;
+    u64 internal_keys;
+    u64 bytes_read;
+    u32 errors_count;
+    StringBuilder errors;
+} CheckTask;
+
+typedef struct {
+    Pager* pager;
+    // One byte per page, set the first time the page is reached from its parent
+    u8* reached;
+    CheckTask* tasks;
+    u32 tasks_count;
+    // Next task for a worker to take
+    u32 next_task;
+} CheckContext;
+
+typedef struct {
+    u32 errors_count;
+    u32 threads_count;
+    u32 subtrees_count;
+    u32 height;
+    u64 leaf_pages;
+    u64 internal_pages;
+    u64 rows;
+    u64 internal_keys;
+    u64 leaf_hops;
+    u64 leaf_jumps;
+} CheckReport;
+
+void check_error(CheckTask* task, const char* format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    i32 length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length >= sizeof(message) - 1) {
+        length = sizeof(message) - 2;
+    }
+    // Messages are kept one per line
+    message[length++] = '\n';
+    task->errors_count++;
+    ARRAY_APPEND_MANY(&task->errors, message, (size_t)length);
+}
+
+// Claims a page for the walk, a page claimed twice has two parents and is only followed the first time
+void* check_load_page(CheckContext* c, CheckTask* task, u32 page_num, u32 parent_page_num, u8* buffer, u8* scratch)
+{
+    Pager* p = c->pager;
+    if (page_num == 0 || page_num >= p->pages_count) {
+        check_error(task, "page %u: points to page %u, which does not exist", parent_page_num, page_num);
+        return NULL;
+    }
+    if (__atomic_exchange_n(&c->reached[page_num], 1, __ATOMIC_RELAXED)) {
+        check_error(task, "page %u: reachable from more than one parent, again from page %u", page_num, parent_page_num);
+        return NULL;
+    }
+    if (p->pages[page_num] && !p->reading[page_num]) {
+        return p->pages[page_num];
+    }
+    size_t bytes_read = 0;
+    PageReadResult result = pager_try_read_page(p, page_num, buffer, scratch, &bytes_read);
+    task->bytes_read += bytes_read;
+    if (result == PAGE_READ_IO_ERROR) {
+        check_error(task, "page %u: unreadable, error %d", page_num, errno);
+        return NULL;
+    }
+    if (result == PAGE_READ_CORRUPT) {
+        check_error(task, "page %u: corrupt compressed page", page_num);
+        return NULL;
+    }
+    return buffer;
+}
+
+/*
+    Checks a node on its own and against the range of keys its parent allows it, and records it in
+    the task's totals. Sets max_key to a leaf's largest key, internal nodes get theirs from their
+    right child. Returns false if the node cannot be descended into.
+*/
+bool check_node(CheckContext* c, CheckTask* task, void* node, u32 page_num, u32 parent_page_num, u32 depth,
+                const Key* lower, const Key* upper, bool* has_keys, Key* max_key)
+{
+    Pager* p = c->pager;
+    char text[KEY_TEXT_SIZE];
+    bool is_root = parent_page_num == INVALID_PAGE_NUM;
+    *has_keys = false;
+    if (get_node_type(node) != NODE_INTERNAL && get_node_type(node) != NODE_LEAF) {
+        check_error(task, "page %u: invalid node type %u", page_num, (u32)get_node_type(node));
+        return false;
+    }
+    if (is_node_root(node) != is_root) {
+        check_error(task, is_root ? "page %u: root page is not marked as root" : "page %u: marked as root but has a parent",
+                    page_num);
+    }
+    if (!is_root && *node_parent(node) != parent_page_num) {
+        check_error(task, "page %u: parent pointer is %u, expected %u", page_num, *node_parent(node), parent_page_num);
+    }
+
+    bool is_leaf = get_node_type(node) == NODE_LEAF;
+    u32 keys_count = is_leaf ? *leaf_node_cells_count(node) : *internal_node_keys_count(node);
+    u32 max_keys = is_leaf ? p->leaf_node_max_cells : INTERNAL_NODE_MAX_CELLS;
+    if (keys_count > max_keys) {
+        check_error(task, "page %u: holds %u keys, more than the %u that fit", page_num, keys_count, max_keys);
+        return false;
+    }
+    for (u32 i = 0; i < keys_count; i++) {
+        Key key = key_load(p, is_leaf ? leaf_node_key(p, node, i) : internal_node_key(p, node, i));
+        if (i > 0 && key_compare(key, *max_key) <= 0) {
+            format_key(p, key, text);
+            check_error(task, "page %u: key %s at cell %u is not above the key before it", page_num, text, i);
+        }
+        if ((lower && key_compare(key, *lower) <= 0) || (upper && key_compare(key, *upper) > 0)) {
+            format_key(p, key, text);
+            check_error(task, "page %u: key %s at cell %u is outside the range its parent allows", page_num, text, i);
+        }
+        *max_key = key;
+    }
+
+    if (!is_leaf) {
+        task->internal_pages++;
+        task->internal_keys += keys_count;
+        if (*internal_node_right_child(node) == INVALID_PAGE_NUM) {
+            check_error(task, "page %u: has no right child", page_num);
+            return false;
+        }
+        return true;
+    }
+
+    task->leaf_pages++;
+    task->rows += keys_count;
+    if (task->leaf_pages == 1 || depth < task->min_leaf_depth) {
+        task->min_leaf_depth = depth;
+    }
+    if (depth > task->max_leaf_depth) {
+        task->max_leaf_depth = depth;
+    }
+    CheckLeaf leaf = { .page_num = page_num, .next_leaf = *leaf_node_next_leaf(node) };
+    ARRAY_APPEND(&task->leaves, leaf);
+    if (keys_count == 0 && !is_root) {
+        check_error(task, "page %u: leaf is empty", page_num);
+    }
+    *has_keys = keys_count > 0;
+    return true;
+}
+
+// Child i's page and the range of keys it may hold, the last child is the right one
+u32 check_child(Pager* p, void* node, u32 i, const Key* lower, const Key* upper, Key* child_lower, Key* child_upper,
+                bool* has_lower, bool* has_upper)
+{
+    u32 keys_count = *internal_node_keys_count(node);
+    *has_lower = i > 0 || lower;
+    if (i > 0) {
+        *child_lower = key_load(p, internal_node_key(p, node, i - 1));
+    } else if (lower) {
+        *child_lower = *lower;
+    }
+    *has_upper = i < keys_count || upper;
+    if (i < keys_count) {
+        *child_upper = key_load(p, internal_node_key(p, node, i));
+        return *internal_node_cell(p, node, i);
+    }
+    if (upper) {
+        *child_upper = *upper;
+    }
+    return *internal_node_right_child(node);
+}
+
+// A separator has to be the largest key of the child to its left
+void check_separator(CheckContext* c, CheckTask* task, u32 page_num, u32 child_page_num, Key separator,
+                     bool child_has_keys, Key child_max_key)
+{
+    if (!child_has_keys) {
+        check_error(task, "page %u: child page %u holds no keys", page_num, child_page_num);
+    } else if (key_compare(separator, child_max_key) != 0) {
+        char separator_text[KEY_TEXT_SIZE];
+        char max_text[KEY_TEXT_SIZE];
+        format_key(c->pager, separator, separator_text);
+        format_key(c->pager, child_max_key, max_text);
+        check_error(task, "page %u: separator key %s does not match child page %u's largest key %s", page_num,
+                    separator_text, child_page_num, max_text);
+    }
+}
+
+// Checks a whole subtree, buffers holds one page per level below depth and scratch two pages
+void check_subtree(CheckContext* c, CheckTask* task, u32 page_num, u32 parent_page_num, u32 depth, const Key* lower,
+                   const Key* upper, u8** buffers, u8* scratch, bool* has_keys, Key* max_key)
+{
+    Pager* p = c->pager;
+    *has_keys = false;
+    if (depth >= CHECK_MAX_HEIGHT) {
+        check_error(task, "page %u: more than %u levels deep", page_num, CHECK_MAX_HEIGHT);
+        return;
+    }
+    if (!buffers[depth]) {
+        buffers[depth] = malloc(p->page_size);
+        assert(buffers[depth] && "Out of ram lol");
+    }
+    void* node = check_load_page(c, task, page_num, parent_page_num, buffers[depth], scratch);
+    if (!node || !check_node(c, task, node, page_num, parent_page_num, depth, lower, upper, has_keys, max_key) ||
+        get_node_type(node) == NODE_LEAF) {
+        return;
+    }
+
+    u32 keys_count = *internal_node_keys_count(node);
+    for (u32 i = 0; i <= keys_count; i++) {
+        Key child_lower, child_upper;
+        bool has_lower, has_upper;
+        u32 child_page_num = check_child(p, node, i, lower, upper, &child_lower, &child_upper, &has_lower, &has_upper);
+        bool child_has_keys;
+        Key child_max_key;
+        check_subtree(c, task, child_page_num, page_num, depth + 1, has_lower ? &child_lower : NULL,
+                      has_upper ? &child_upper : NULL, buffers, scratch, &child_has_keys, &child_max_key);
+        if (i < keys_count) {
+            check_separator(c, task, page_num, child_page_num, child_upper, child_has_keys, child_max_key);
+        } else {
+            *has_keys = child_has_keys;
+            *max_key = child_max_key;
+        }
+    }
+}
+
+void* check_worker(void* arg)
+{
+    CheckContext* c = arg;
+    u8* buffers[CHECK_MAX_HEIGHT] = {0};
+    u8* scratch = malloc(2 * c->pager->page_size);
+    assert(scratch && "Out of ram lol");
+    for (;;) {
+        u32 i = __atomic_fetch_add(&c->next_task, 1, __ATOMIC_RELAXED);
+        if (i >= c->tasks_count) {
+            break;
+        }
+        CheckTask* task = &c->tasks[i];
+        if (!task->split) {
+            check_subtree(c, task, task->page_num, task->parent_page_num, task->depth, task->has_lower ? &task->lower : NULL,
+                          task->has_upper ? &task->upper : NULL, buffers, scratch, &task->has_keys, &task->max_key);
+        }
+    }
+    for (u32 i = 0; i < CHECK_MAX_HEIGHT; i++) {
+        free(buffers[i]);
+    }
+    free(scratch);
+    return NULL;
+}
+
+u32 check_threads_count()
+{
+#ifdef PLATFORM_WINDOWS
+    return 1;
+#else
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1) {
+        return 1;
+    }
+    return online < CHECK_MAX_THREADS ? (u32)online : CHECK_MAX_THREADS;
+#endif
+}
+
+// Splits subtrees a level at a time until there are enough of them to go around the threads
+void check_split_tasks(CheckContext* c, u32 wanted, u8* buffer, u8* scratch)
+{
+    Pager* p = c->pager;
+    u32 level_start = 0;
+    u32 pending = c->tasks_count;
+    while (pending < wanted && level_start < c->tasks_count) {
+        u32 level_end = c->tasks_count;
+        for (u32 t = level_start; t < level_end && pending < wanted; t++) {
+            CheckTask* task = &c->tasks[t];
+            if (task->depth + 1 >= CHECK_MAX_HEIGHT) {
+                continue;
+            }
+            void* node = check_load_page(c, task, task->page_num, task->parent_page_num, buffer, scratch);
+            // Copies, appending children may move the tasks around
+            Key lower_key = task->lower;
+            Key upper_key = task->upper;
+            const Key* lower = task->has_lower ? &lower_key : NULL;
+            const Key* upper = task->has_upper ? &upper_key : NULL;
+            task->split = true;
+            if (!node || !check_node(c, task, node, task->page_num, task->parent_page_num, task->depth, lower, upper,
+                                     &task->has_keys, &task->max_key)) {
+                continue;
+            }
+            if (get_node_type(node) == NODE_LEAF) {
+                // Already done, as a task without children
+                continue;
+            }
+
+            u32 keys_count = *internal_node_keys_count(node);
+            task->first_child_task = c->tasks_count;
+            task->children_count = keys_count + 1;
+            for (u32 i = 0; i <= keys_count; i++) {
+                CheckTask child = {0};
+                child.page_num = check_child(p, node, i, lower, upper, &child.lower, &child.upper, &child.has_lower,
+                                             &child.has_upper);
+                child.parent_page_num = task->page_num;
+                child.depth = task->depth + 1;
+                child.parent_task = (i32)t;
+                c->tasks_count++;
+                c->tasks = realloc(c->tasks, c->tasks_count * sizeof(CheckTask));
+                assert(c->tasks && "Out of ram lol");
+                c->tasks[c->tasks_count - 1] = child;
+                task = &c->tasks[t];
+            }
+            pending += keys_count;
+        }
+        level_start = level_end;
+    }
+}
+
+// Visits the subtrees in key order, which puts their leaves in the order the leaf chain should follow
+void check_leaf_chain(CheckContext* c, u32 t, CheckTask* errors, CheckLeaf** previous, CheckReport* report)
+{
+    CheckTask* task = &c->tasks[t];
+    for (u32 i = 0; i < task->leaves.count; i++) {
+        CheckLeaf* leaf = &task->leaves.data[i];
+        if (*previous) {
+            if ((*previous)->next_leaf != leaf->page_num) {
+                check_error(errors, "page %u: next leaf is %u, expected %u", (*previous)->page_num,
+                            (*previous)->next_leaf, leaf->page_num);
+            }
+            report->leaf_hops++;
+            report->leaf_jumps += leaf->page_num != (*previous)->page_num + 1;
+        }
+        *previous = leaf;
+    }
+    for (u32 i = 0; i < task->children_count; i++) {
+        check_leaf_chain(c, task->first_child_task + i, errors, previous, report);
+    }
+}
+
+/*
+    Checks the structure of the whole tree: node types, root flags and parent pointers, key order
+    within nodes and against the range each parent allows, separator keys against the largest key
+    of the child on their left, leaves all at the same depth, the leaf chain visiting every leaf in
+    key order, and every page being reached exactly once. Errors are printed as they are found, up
+    to a limit, and counted in the report along with the tree's shape.
+*/
+void table_check(Table* t, CheckReport* report)
+{
+    Pager* p = t->pager;
+    memset(report, 0, sizeof(*report));
+    /*
+        The walk reads the cache from several threads, so nothing may still be landing in it. Prefetched
+        pages are left undecoded, the walk reads them again itself so a corrupt one becomes an error
+        in the report rather than ending the process.
+    */
+    page_io_wait_all(p->io);
+
+    CheckContext c = {0};
+    c.pager = p;
+    c.reached = calloc(p->pages_count, 1);
+    c.tasks = calloc(1, sizeof(CheckTask));
+    assert(c.reached && c.tasks && "Out of ram lol");
+    c.reached[0] = 1;
+    c.tasks[0].page_num = t->root_page_num;
+    c.tasks[0].parent_page_num = INVALID_PAGE_NUM;
+    c.tasks[0].parent_task = -1;
+    c.tasks_count = 1;
+
+    u32 threads_count = check_threads_count();
+    u8* buffer = malloc(p->page_size);
+    u8* scratch = malloc(2 * p->page_size);
+    assert(buffer && scratch && "Out of ram lol");
+    check_split_tasks(&c, threads_count * CHECK_TASKS_PER_THREAD, buffer, scratch);
+    free(buffer);
+    free(scratch);
+
+    for (u32 i = 0; i < c.tasks_count; i++) {
+        report->subtrees_count += c.tasks[i].children_count == 0;
+    }
+    if (threads_count > report->subtrees_count) {
+        threads_count = report->subtrees_count > 0 ? report->subtrees_count : 1;
+    }
+    report->threads_count = 1;
+#ifndef PLATFORM_WINDOWS
+    pthread_t threads[CHECK_MAX_THREADS];
+    u32 started = 0;
+    for (; started + 1 < threads_count; started++) {
+        if (pthread_create(&threads[started], NULL, check_worker, &c) != 0) {
+            break;
+        }
+    }
+    report->threads_count += started;
+#endif
+    // The calling thread works too, and does everything if no thread could be started
+    check_worker(&c);
+#ifndef PLATFORM_WINDOWS
+    for (u32 i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#endif
+
+    // Children come after their parent, so going backwards every split task sees its children's results
+    CheckTask checks = {0};
+    for (u32 i = c.tasks_count; i-- > 1;) {
+        CheckTask* task = &c.tasks[i];
+        CheckTask* parent = &c.tasks[task->parent_task];
+        u32 child = i - parent->first_child_task;
+        if (child + 1 == parent->children_count) {
+            parent->has_keys = task->has_keys;
+            parent->max_key = task->max_key;
+        } else {
+            check_separator(&c, &checks, parent->page_num, task->page_num, task->upper, task->has_keys, task->max_key);
+        }
+    }
+
+    CheckLeaf* previous = NULL;
+    check_leaf_chain(&c, 0, &checks, &previous, report);
+    if (previous && previous->next_leaf != 0) {
+        check_error(&checks, "page %u: last leaf points to next leaf %u", previous->page_num, previous->next_leaf);
+    }
+    for (u32 i = 1; i < p->pages_count; i++) {
+        if (!c.reached[i]) {
+            check_error(&checks, "page %u: not reachable from the root", i);
+        }
+    }
+
+    u32 min_leaf_depth = UINT32_MAX;
+    u32 max_leaf_depth = 0;
+    u32 printed = 0;
+    for (u32 i = 0; i <= c.tasks_count; i++) {
+        CheckTask* task = i < c.tasks_count ? &c.tasks[i] : &checks;
+        report->leaf_pages += task->leaf_pages;
+        report->internal_pages += task->internal_pages;
+        report->rows += task->rows;
+        report->internal_keys += task->internal_keys;
+        report->errors_count += task->errors_count;
+        p->stats.bytes_read += task->bytes_read;
+        if (task->leaf_pages > 0) {
+            min_leaf_depth = task->min_leaf_depth < min_leaf_depth ? task->min_leaf_depth : min_leaf_depth;
+            max_leaf_depth = task->max_leaf_depth > max_leaf_depth ? task->max_leaf_depth : max_leaf_depth;
+        }
+        for (size_t start = 0, end = 0; end < task->errors.count; end++) {
+            if (task->errors.data[end] != '\n') {
+                continue;
+            }
+            if (printed++ < CHECK_MAX_ERRORS_PRINTED) {
+                printf("Error: %.*s\n", (i32)(end - start), task->errors.data + start);
+            }
+            start = end + 1;
+        }
+        ARRAY_FREE(&task->errors);
+        ARRAY_FREE(&task->leaves);
+    }
+    if (min_leaf_depth != max_leaf_depth && report->leaf_pages > 0) {
+        printf("Error: leaves are at depths %u to %u, they should all be at the same one\n", min_leaf_depth, max_leaf_depth);
+        printed++;
+        report->errors_count++;
+    }
+    if (printed > CHECK_MAX_ERRORS_PRINTED) {
+        printf("... and %u more errors\n", printed - CHECK_MAX_ERRORS_PRINTED);
+    }
+    report->height = report->leaf_pages > 0 ? max_leaf_depth + 1 : 0;
+    free(c.tasks);
+    free(c.reached);
+}
+
+void print_check_report(Pager* p, CheckReport* r)
+{
+    if (r->errors_count == 0) {
+        printf("Integrity check: ok\n");
+    } else {
+        printf("Integrity check: %u errors\n", r->errors_count);
+    }
+    printf("pages: %u (1 header, %llu internal, %llu leaf)\n", p->pages_count, (unsigned long long)r->internal_pages,
+           (unsigned long long)r->leaf_pages);
+    printf("height: %u\n", r->height);
+    printf("rows: %llu\n", (unsigned long long)r->rows);
+    printf("leaf_fill: %.1f%%\n", r->leaf_pages ? 100.0 * r->rows / (r->leaf_pages * p->leaf_node_max_cells) : 0.0);
+    printf("internal_fill: %.1f%%\n",
+           r->internal_pages ? 100.0 * r->internal_keys / (r->internal_pages * INTERNAL_NODE_MAX_CELLS) : 0.0);
+    // A scan moves from each leaf to the next in key order, a hop that is not to the following page is a seek
+    printf("leaf_fragmentation: %.1f%% (%llu of %llu leaf hops are not to the next page)\n",
+           r->leaf_hops ? 100.0 * r->leaf_jumps / r->leaf_hops : 0.0, (unsigned long long)r->leaf_jumps,
+           (unsigned long long)r->leaf_hops);
+    printf("threads: %u over %u subtrees\n", r->threads_count, r->subtrees_count);
+}
+
+bool db_backup(Table* t, const char* path, BackupInfo* info);
+bool db_save(Table* t, const char* path);
+
+MetaCommandResult do_meta_command(StringBuilder* sb, Table* t)
+{
+    if (strcmp(sb->data, ".exit") == 0) {
+        return META_COMMAND_EXIT;
+    }
+    if (strcmp(sb->data, ".constants") == 0) {
+        print_constants(t->pager);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(sb->data, ".btree") == 0) {
+        printf("Tree:\n");
+        print_tree(t->pager, t->root_page_num, 0);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(sb->data, ".check") == 0) {
+        CheckReport report;
+        table_check(t, &report);
+        print_check_report(t->pager, &report);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(sb->data, ".stats") == 0) {
+        print_stats(t);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(sb->data, ".stats json") == 0) {
+        print_stats_json(t);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strcmp(sb->data, ".stats reset") == 0) {
+        reset_stats(t);
+        return META_COMMAND_SUCCESS;
+    }
+    if (strncmp(sb->data, ".save ", 6) == 0) {
+        if (db_save(t, sb->data + 6)) {
+            printf("Saved %u pages to '%s'.\n", t->pager->pages_count, sb->data + 6);
+        }
+        return META_COMMAND_SUCCESS;
+    }
+    if (strncmp(sb->data, ".backup ", 8) == 0) {
+        BackupInfo info;
+        if (db_backup(t, sb->data + 8, &info)) {
+            printf("Backed up %u of %u pages (%s, %s).\n", info.pages_copied, info.pages_count,
+                   info.incremental ? "incremental" : "full", file_copy_method_name(info.method));
+        }
+        return META_COMMAND_SUCCESS;
+    }
+    return META_COMMAND_UNKNOWN_COMMAND;
+}
+
+PrepareResult parse_key_part(const char* text, u64 max, u64* part)
+{
+    if (text[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (text[0] < '0' || text[0] > '9') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*end != '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (errno == ERANGE || value > max) {
+        return PREPARE_ID_TOO_BIG;
+    }
+    *part = value;
+    return PREPARE_SUCCESS;
+}
+
+// Integer keys are plain numbers, composite keys are written as tenant:id
+PrepareResult parse_key(Pager* p, char* text, Key* key)
+{
+    key->tenant = 0;
+    switch (p->key_type) {
+        case KEY_TYPE_U32:
+            return parse_key_part(text, UINT32_MAX, &key->id);
+        case KEY_TYPE_U64:
+            return parse_key_part(text, UINT64_MAX, &key->id);
+        case KEY_TYPE_COMPOSITE: {
+            char* separator = strchr(text, ':');
+            if (!separator) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            *separator = '\0';
+            PrepareResult result = parse_key_part(text, UINT64_MAX, &key->tenant);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+            return parse_key_part(separator + 1, UINT64_MAX, &key->id);
+        }
+        default:
+            assert(false && "Invalid key type in parse_key");
+            return PREPARE_SYNTAX_ERROR;
+    }
+}
+
+PrepareResult prepare_insert(StringBuilder* sb, Table* t, Statement* s)
+{
+    s->type = STATEMENT_INSERT;
+    s->replace = false;
+    strtok(sb->data, " ");
+    char* id_string = strtok(NULL, " ");
+    if (id_string && strcmp(id_string, "or") == 0) {
+        char* action = strtok(NULL, " ");
+        if (!action || strcmp(action, "replace") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        s->replace = true;
+        id_string = strtok(NULL, " ");
+    }
+    char* username = strtok(NULL, " ");
+    char* email = strtok(NULL, " ");
+
+    if (!id_string || !username || !email) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (strlen(username) > COLUMN_USERNAME_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    if (strlen(email) > COLUMN_EMAIL_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+
+    PrepareResult result = parse_key(t->pager, id_string, &s->row_to_insert.key);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+
+    strcpy(s->row_to_insert.username, username);
+    strcpy(s->row_to_insert.email, email);
+
+    return PREPARE_SUCCESS;
+}
+
+// update <id> set username=<username>, email=<email>, either assignment may be left out
+PrepareResult prepare_update(StringBuilder* sb, Table* t, Statement* s)
+{
+    s->type = STATEMENT_UPDATE;
+    s->update_username = false;
+    s->update_email = false;
+    strtok(sb->data, " ");
+    char* id_string = strtok(NULL, " ");
+    char* set = strtok(NULL, " ");
+    if (!id_string || !set || strcmp(set, "set") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    for (char* assignment = strtok(NULL, ", "); assignment; assignment = strtok(NULL, ", ")) {
+        char* value = strchr(assignment, '=');
+        if (!value) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        *value++ = '\0';
+        if (strcmp(assignment, "username") == 0) {
+            if (strlen(value) > COLUMN_USERNAME_SIZE) {
+                return PREPARE_STRING_TOO_LONG;
+            }
+            strcpy(s->row_to_insert.username, value);
+            s->update_username = true;
+        } else if (strcmp(assignment, "email") == 0) {
+            if (strlen(value) > COLUMN_EMAIL_SIZE) {
+                return PREPARE_STRING_TOO_LONG;
+            }
+            strcpy(s->row_to_insert.email, value);
+            s->update_email = true;
+        } else {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (!s->update_username && !s->update_email) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    return parse_key(t->pager, id_string, &s->row_to_insert.key);
+}
+
+// Values may be wrapped in single quotes, they cannot contain spaces either way
+PrepareResult prepare_text_filter(TextFilter* f, bool like, char* value)
+{
+    size_t length = strlen(value);
+    if (value[0] == '\'') {
+        if (length < 2 || value[length - 1] != '\'') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        value++;
+        length -= 2;
+    }
+    if (length > COLUMN_EMAIL_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+
+    f->enabled = true;
+    f->kind = TEXT_MATCH_EQUALS;
+    if (like) {
+        bool leading = length > 0 && value[0] == '%';
+        bool trailing = length > (size_t)leading && value[length - 1] == '%';
+        size_t inner_start = leading;
+        size_t inner_length = length - leading - trailing;
+        bool inner_has_wildcards = memchr(value + inner_start, '%', inner_length) || memchr(value + inner_start, '_', inner_length);
+        if (inner_has_wildcards) {
+            f->kind = TEXT_MATCH_LIKE;
+        } else {
+            f->kind = leading && trailing ? TEXT_MATCH_CONTAINS : leading ? TEXT_MATCH_SUFFIX : trailing ? TEXT_MATCH_PREFIX : TEXT_MATCH_EQUALS;
+            value += inner_start;
+            length = inner_length;
+        }
+    }
+    memcpy(f->needle, value, length);
+    f->needle[length] = '\0';
+    f->needle_length = (u32)length;
+    return PREPARE_SUCCESS;
+}
+
+// where id = <key> | username|email = <value> | username|email like <pattern>
+PrepareResult prepare_where(Table* t, Statement* s)
+{
+    char* column = strtok(NULL, " ");
+    char* operator = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    if (!column || !operator || !value) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    bool like = strcmp(operator, "like") == 0;
+    if (!like && strcmp(operator, "=") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (strcmp(column, "id") == 0 && !like) {
+        s->where_key = true;
+        return parse_key(t->pager, value, &s->row_to_insert.key);
+    }
+    if (strcmp(column, "username") == 0 || strcmp(column, "email") == 0) {
+        s->filter.on_email = strcmp(column, "email") == 0;
+        return prepare_text_filter(&s->filter, like, value);
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+// select [where <condition>] [order by username|email [asc|desc]]
+PrepareResult prepare_select(StringBuilder* sb, Table* t, Statement* s)
+{
+    s->type = STATEMENT_SELECT;
+    s->order_by = ORDER_BY_KEY;
+    s->descending = false;
+    s->where_key = false;
+    s->filter.enabled = false;
+    strtok(sb->data, " ");
+    char* token = strtok(NULL, " ");
+    if (token && strcmp(token, "where") == 0) {
+        PrepareResult result = prepare_where(t, s);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        token = strtok(NULL, " ");
+    }
+    if (!token) {
+        return PREPARE_SUCCESS;
+    }
+
+    char* by = strtok(NULL, " ");
+    char* column = strtok(NULL, " ");
+    if (strcmp(token, "order") != 0 || !by || strcmp(by, "by") != 0 || !column) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (strcmp(column, "username") == 0) {
+        s->order_by = ORDER_BY_USERNAME;
+    } else if (strcmp(column, "email") == 0) {
+        s->order_by = ORDER_BY_EMAIL;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* direction = strtok(NULL, " ");
+    if (direction) {
+        if (strcmp(direction, "desc") == 0) {
+            s->descending = true;
+        } else if (strcmp(direction, "asc") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (strtok(NULL, " ")) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_statement(StringBuilder* sb, Table* t, Statement* s)
+{
+    assert(s && "Must provide a valid Statement ptr");
+    if (strncmp(sb->data, "insert", 6) == 0) {
+        return prepare_insert(sb, t, s);
+    }
+    if (strncmp(sb->data, "update", 6) == 0) {
+        return prepare_update(sb, t, s);
+    }
+    if (strncmp(sb->data, "select", 6) == 0 && (sb->data[6] == ' ' || sb->data[6] == '\0')) {
+        return prepare_select(sb, t, s);
+    }
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+// Whether a cursor returned by table_find points at the key itself rather than at its insert position
+bool cursor_at_key(Cursor c, Key key)
+{
+    void* node = get_page(c.table->pager, c.page_num);
+    if (c.cell_num >= *leaf_node_cells_count(node)) {
+        return false;
+    }
+    Key key_at_index = key_load(c.table->pager, leaf_node_key(c.table->pager, node, c.cell_num));
+    return key_compare(key, key_at_index) == 0;
+}
+
+/*
+    Keys larger than everything in the table always go at the end of the rightmost leaf, so increasing
+    keys can be placed there without descending from the root and without a duplicate check.
+*/
+bool table_append_position(Table* t, Key key, Cursor* cursor)
+{
+    if (t->rightmost_leaf_page_num == INVALID_PAGE_NUM) {
+        u32 page_num = t->root_page_num;
+        void* node = get_page(t->pager, page_num);
+        while (get_node_type(node) == NODE_INTERNAL) {
+            page_num = *internal_node_right_child(node);
+            node = get_page(t->pager, page_num);
+        }
+        t->rightmost_leaf_page_num = page_num;
+    }
+
+    void* leaf = get_page(t->pager, t->rightmost_leaf_page_num);
+    u32 cells_count = *leaf_node_cells_count(leaf);
+    if (cells_count > 0 && key_compare(key, key_load(t->pager, leaf_node_key(t->pager, leaf, cells_count - 1))) <= 0) {
+        return false;
+    }
+    cursor->table = t;
+    cursor->page_num = t->rightmost_leaf_page_num;
+    cursor->cell_num = cells_count;
+    cursor->end_of_table = true;
+    t->stats.rightmost_appends++;
+    return true;
+}
+
+ExecuteResult execute_insert(Statement* s, Table* t)
+{
+    assert(s && t && "Must provide valid ptrs to execute_insert");
+    Key key_to_insert = s->row_to_insert.key;
+    Cursor cursor;
+    if (table_append_position(t, key_to_insert, &cursor)) {
+        leaf_node_insert(cursor, key_to_insert, &s->row_to_insert);
+        return EXECUTE_SUCCESS;
+    }
+
+    // The leaf is read to place the row anyway, so the filters would save nothing here
+    cursor = table_find(t, key_to_insert);
+    if (cursor_at_key(cursor, key_to_insert)) {
+        if (!s->replace) {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+        // Rows have a fixed size, so the new one always fits in the old cell
+        serialize_row(t->pager, &s->row_to_insert, cursor_value(cursor));
+        row_cache_remove(&t->row_cache, &key_to_insert, key_hash(key_to_insert));
+        pager_mark_dirty(t->pager, cursor.page_num);
+        return EXECUTE_SUCCESS;
+    }
+    leaf_node_insert(cursor, key_to_insert, &s->row_to_insert);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_update(Statement* s, Table* t)
+{
+    assert(s && t && "Must provide valid ptrs to execute_update");
+    Pager* p = t->pager;
+    Cursor cursor;
+    if (!table_find_existing(t, s->row_to_insert.key, &cursor) || !cursor_at_key(cursor, s->row_to_insert.key)) {
+        return EXECUTE_KEY_NOT_FOUND;
+    }
+
+    // Only the assigned columns are rewritten, the key and the leaf layout stay as they are
+    void* value = cursor_value(cursor);
+    if (s->update_username) {
+        strncpy(value + row_username_offset(p), s->row_to_insert.username, USERNAME_SIZE);
+    }
+    if (s->update_email) {
+        strncpy(value + row_email_offset(p), s->row_to_insert.email, EMAIL_SIZE);
+    }
+    pager_mark_dirty(p, cursor.page_num);
+    row_cache_remove(&t->row_cache, &s->row_to_insert.key, key_hash(s->row_to_insert.key));
+    return EXECUTE_SUCCESS;
+}
+
+typedef struct {
+    u32 column_offset;
+    u32 column_size;
+    bool descending;
+} RowOrder;
+
+// Compares serialized rows on one of their string columns
+i32 compare_rows_by_column(const void* a, const void* b, void* context)
+{
+    RowOrder* order = context;
+    i32 cmp = strncmp((const char*)a + order->column_offset, (const char*)b + order->column_offset, order->column_size);
+    return order->descending ? -cmp : cmp;
+}
+
+// Runs on the serialized row inside the leaf page, so rows that fail the filter are never copied out
+bool row_passes_filter(Pager* p, TextFilter* f, const u8* value)
+{
+    if (!f->enabled) {
+        return true;
+    }
+    const char* slot = (const char*)value + (f->on_email ? row_email_offset(p) : row_username_offset(p));
+    u32 length = text_length(slot, f->on_email ? EMAIL_SIZE : USERNAME_SIZE);
+    switch (f->kind) {
+        case TEXT_MATCH_EQUALS:
+            return length == f->needle_length && text_equals(slot, f->needle, length);
+        case TEXT_MATCH_PREFIX:
+            return length >= f->needle_length && text_equals(slot, f->needle, f->needle_length);
+        case TEXT_MATCH_SUFFIX:
+            return length >= f->needle_length && text_equals(slot + length - f->needle_length, f->needle, f->needle_length);
+        case TEXT_MATCH_CONTAINS:
+            return text_contains(slot, length, f->needle, f->needle_length);
+        case TEXT_MATCH_LIKE:
+            return text_like(slot, length, f->needle, f->needle_length);
+        default:
+            assert(false && "Invalid text match kind in row_passes_filter");
+            return false;
+    }
+}
+
+/*
+    Rows come off the leaf chain in key order, so any other order goes through the sorter, which keeps
+    at most t->sort_memory bytes of rows in memory and merges spilled runs as the rows are printed.
+    Rows with equal columns stay in key order because the sort is stable.
+*/
+ExecuteResult execute_select_ordered(Statement* s, Table* t)
+{
+    Pager* p = t->pager;
+    RowOrder order = {
+        .column_offset = s->order_by == ORDER_BY_USERNAME ? row_username_offset(p) : row_email_offset(p),
+        .column_size = s->order_by == ORDER_BY_USERNAME ? USERNAME_SIZE : EMAIL_SIZE,
+        .descending = s->descending,
+    };
+    Sorter sorter;
+    sorter_init(&sorter, p->row_size, t->sort_memory, compare_rows_by_column, &order);
+
+    Cursor cursor = table_start(t);
+    while (!cursor.end_of_table) {
+        void* value = cursor_value(cursor);
+        if (row_passes_filter(p, &s->filter, value)) {
+            sorter_add(&sorter, value);
+        }
+        cursor_advance(&cursor);
+    }
+    sorter_finish(&sorter);
+    t->stats.sort_runs_spilled += sorter.runs_count;
+
+    Row row;
+    for (const void* value = sorter_next(&sorter); value; value = sorter_next(&sorter)) {
+        deserialize_row(p, (void*)value, &row);
+        print_row(p, &row);
+    }
+    sorter_destroy(&sorter);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_select_key(Statement* s, Table* t)
+{
+    Key key = s->row_to_insert.key;
+    u64 hash = key_hash(key);
+    const Row* cached = row_cache_get(&t->row_cache, &key, hash);
+    if (cached) {
+        print_row(t->pager, (Row*)cached);
+        return EXECUTE_SUCCESS;
+    }
+
+    Cursor cursor;
+    if (table_find_existing(t, key, &cursor) && cursor_at_key(cursor, key)) {
+        Row row;
+        deserialize_row(t->pager, cursor_value(cursor), &row);
+        row_cache_put(&t->row_cache, &key, hash, &row);
+        print_row(t->pager, &row);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_select(Statement* s, Table* t)
+{
+    assert(s && t && "Must provide valid ptrs to execute_select");
+    if (s->where_key) {
+        return execute_select_key(s, t);
+    }
+    if (s->order_by != ORDER_BY_KEY) {
+        return execute_select_ordered(s, t);
+    }
+    Cursor cursor = table_start(t);
+    Row row;
+    while (!cursor.end_of_table) {
+        void* value = cursor_value(cursor);
+        if (row_passes_filter(t->pager, &s->filter, value)) {
+            deserialize_row(t->pager, value, &row);
+            print_row(t->pager, &row);
+        }
+        cursor_advance(&cursor);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_statement(Statement* s, Table* t)
+{
+    assert(s && t && "Must provide a valid ptrs to execute_statement");
+    switch (s->type) {
+        case STATEMENT_INSERT:
+            return execute_insert(s, t);
+        case STATEMENT_SELECT:
+            return execute_select(s, t);
+        case STATEMENT_UPDATE:
+            return execute_update(s, t);
+        default:
+            assert(false && "Invalid statement type in execute_statement");
+            return EXECUTE_FAILURE;
+    }
+}
+
+bool is_valid_page_size(u32 page_size)
+{
+    bool is_power_of_two = (page_size & (page_size - 1)) == 0;
+    return is_power_of_two && page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE;
+}
+
+DbOptions default_db_options()
+{
+    DbOptions options = {
+        .page_size = DEFAULT_PAGE_SIZE,
+        .key_type = KEY_TYPE_U32,
+        .huge_pages = false,
+        .allow_io_uring = true,
+        .sort_memory = DEFAULT_SORT_MEMORY,
+        .bloom_filters = false,
+        .row_cache_memory = 0,
+        .compress_pages = false,
+    };
+    return options;
+}
+
+bool parse_db_option(i32 argc, char** argv, i32* i, DbOptions* options)
+{
+    if (strcmp(argv[*i], "--page-size") == 0 && *i + 1 < argc) {
+        options->page_size = (u32)atol(argv[++*i]);
+        if (!is_valid_page_size(options->page_size)) {
+            printf("Page size must be a power of two between %u and %u.\n", MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    } else if (strcmp(argv[*i], "--key-type") == 0 && *i + 1 < argc) {
+        const char* name = argv[++*i];
+        options->key_type = KEY_TYPES_COUNT;
+        for (u32 type = 0; type < KEY_TYPES_COUNT; type++) {
+            if (strcmp(name, key_type_name(type)) == 0) {
+                options->key_type = type;
+            }
+        }
+        if (options->key_type == KEY_TYPES_COUNT) {
+            printf("Key type must be one of u32, u64 or composite.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (strcmp(argv[*i], "--sort-memory") == 0 && *i + 1 < argc) {
+        options->sort_memory = (size_t)strtoull(argv[++*i], NULL, 10);
+        if (options->sort_memory == 0) {
+            printf("Sort memory must be a positive number of bytes.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (strcmp(argv[*i], "--row-cache") == 0 && *i + 1 < argc) {
+        options->row_cache_memory = (size_t)strtoull(argv[++*i], NULL, 10);
+    } else if (strcmp(argv[*i], "--compress") == 0) {
+        options->compress_pages = true;
+    } else if (strcmp(argv[*i], "--bloom-filters") == 0) {
+        options->bloom_filters = true;
+    } else if (strcmp(argv[*i], "--huge-pages") == 0) {
+        options->huge_pages = true;
+    } else if (strcmp(argv[*i], "--no-io-uring") == 0) {
+        options->allow_io_uring = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void pager_set_layout(Pager* p, u32 page_size, KeyType key_type)
+{
+    p->page_size = page_size;
+    p->key_type = key_type;
+    p->key_size = key_type_size(key_type);
+    p->row_size = ROW_SIZE_FOR_KEY(p->key_size);
+    p->leaf_node_cell_size = LEAF_NODE_CELL_SIZE_FOR_KEY(p->key_size);
+    p->internal_node_cell_size = INTERNAL_NODE_CELL_SIZE_FOR_KEY(p->key_size);
+    p->leaf_node_space_for_cells = page_size - LEAF_NODE_HEADER_SIZE;
+    p->leaf_node_max_cells = p->leaf_node_space_for_cells / p->leaf_node_cell_size;
+    p->leaf_node_right_split_count = (p->leaf_node_max_cells + 1) / 2;
+    p->leaf_node_left_split_count = (p->leaf_node_max_cells + 1) - p->leaf_node_right_split_count;
+}
+
+void pager_set_compression(Pager* p, bool compress_pages)
+{
+    p->compress_pages = compress_pages;
+    if (compress_pages) {
+        p->packed_buffer = malloc(2 * p->page_size);
+        if (!p->packed_buffer) {
+            printf("Error allocating the page compression buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+Pager* pager_open(const char* filename, const DbOptions* options)
+{
+    int fd = -1;
+    u64 file_length = 0;
+    // An in-memory database behaves like a new empty file whose pages are never read or flushed
+    if (strcmp(filename, MEMORY_DB_FILENAME) != 0) {
+#ifdef PLATFORM_WINDOWS
+        fd = _open(filename, _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+#endif
+        if (fd == -1) {
+            fprintf(stderr, "Error opening pager file.");
+            exit(EXIT_FAILURE);
+        }
+
+#ifdef PLATFORM_WINDOWS
+        struct _stat64 file_stat;
+        if (_fstat64(fd, &file_stat) != 0) {
+#else
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+#endif
+            printf("Error reading db file size: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        file_length = (u64)file_stat.st_size;
+    }
+
+    Pager* pager = malloc(sizeof(Pager));
+    pager->file_descriptor = fd;
+    pager->file_length = file_length;
+    pager->pages_count = 0;
+    memset(&pager->stats, 0, sizeof(pager->stats));
+    memset(pager->pages, 0, sizeof(pager->pages));
+    memset(pager->dirty, 0, sizeof(pager->dirty));
+    memset(pager->reading, 0, sizeof(pager->reading));
+    memset(pager->changed_since_backup, 0, sizeof(pager->changed_since_backup));
+    pager->last_backup_path = NULL;
+    pager->last_backup_length = 0;
+    pager->io = page_io_create(options->allow_io_uring);
+    pager->packed_buffer = NULL;
+
+    if (file_length == 0) {
+        // New database file, db_open writes the header
+        if (options->compress_pages && options->page_size <= PAGE_FRAME_BLOCK_SIZE) {
+            printf("Compressed pages need a page size of at least %u.\n", 2 * PAGE_FRAME_BLOCK_SIZE);
+            exit(EXIT_FAILURE);
+        }
+        pager_set_layout(pager, options->page_size, options->key_type);
+        pager_set_compression(pager, options->compress_pages);
+        frame_arena_init(&pager->frames, pager->page_size, TABLE_MAX_PAGES, options->huge_pages);
+        return pager;
+    }
+
+    u8 header[DB_HEADER_SIZE];
+    if (file_read_at(fd, header, DB_HEADER_SIZE, 0) != DB_HEADER_SIZE ||
+        memcmp(db_header_magic(header), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) != 0) {
+        printf("File is not a MySQLite database.\n");
+        exit(EXIT_FAILURE);
+    }
+    u32 format_version = *db_header_format_version(header);
+    if (format_version != DB_FORMAT_VERSION) {
+        printf("Unsupported db format version %u.\n", format_version);
+        exit(EXIT_FAILURE);
+    }
+    u32 page_size = *db_header_page_size(header);
+    if (!is_valid_page_size(page_size)) {
+        printf("Invalid page size %u in db header. Corrupt file.\n", page_size);
+        exit(EXIT_FAILURE);
+    }
+    u32 pages_count = *db_header_pages_count(header);
+    if (file_length != (u64)pages_count * page_size) {
+        printf("Db file length does not match the %u pages in its header. Corrupt file.\n", pages_count);
+        exit(EXIT_FAILURE);
+    }
+    u32 root_page_num = *db_header_root_page(header);
+    if (root_page_num == 0 || root_page_num >= pages_count) {
+        printf("Invalid root page %u in db header. Corrupt file.\n", root_page_num);
+        exit(EXIT_FAILURE);
+    }
+
+    u32 key_type = *db_header_key_type(header);
+    if (key_type >= KEY_TYPES_COUNT) {
+        printf("Invalid key type %u in db header. Corrupt file.\n", key_type);
+        exit(EXIT_FAILURE);
+    }
+    u32 flags = *db_header_flags(header);
+    if (flags & ~DB_KNOWN_FLAGS) {
+        printf("Unsupported db features 0x%x in db header.\n", flags & ~DB_KNOWN_FLAGS);
+        exit(EXIT_FAILURE);
+    }
+
+    pager_set_layout(pager, page_size, (KeyType)key_type);
+    pager_set_compression(pager, flags & DB_FLAG_COMPRESSED_PAGES);
+    frame_arena_init(&pager->frames, pager->page_size, TABLE_MAX_PAGES, options->huge_pages);
+    pager->pages_count = pages_count;
+    return pager;
+}
+
+Table* db_open(const char* filename, const DbOptions* options)
+{
+    Pager* pager = pager_open(filename, options);
+    Table* t = malloc(sizeof(Table));
+    t->pager = pager;
+    t->rightmost_leaf_page_num = INVALID_PAGE_NUM;
+    t->sort_memory = options->sort_memory;
+    t->use_leaf_filters = options->bloom_filters;
+    t->leaf_filters_built = false;
+    if (t->use_leaf_filters) {
+        bloom_filters_init(&t->leaf_filters, TABLE_MAX_PAGES, pager->leaf_node_max_cells);
+    }
+    row_cache_init(&t->row_cache, sizeof(Key), sizeof(Row), options->row_cache_memory);
+    memset(&t->stats, 0, sizeof(t->stats));
+
+    if (pager->pages_count == 0) {
+        // New database file, page 0 holds the header and page 1 starts as the root leaf node
+        void* header = get_page(pager, 0);
+        memset(header, 0, pager->page_size);
+        memcpy(db_header_magic(header), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE);
+        *db_header_format_version(header) = DB_FORMAT_VERSION;
+        *db_header_page_size(header) = pager->page_size;
+        *db_header_root_page(header) = 1;
+        *db_header_key_type(header) = pager->key_type;
+        *db_header_flags(header) = pager->compress_pages ? DB_FLAG_COMPRESSED_PAGES : 0;
+
+        void* root_node = get_page(pager, 1);
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+    }
+
+    t->root_page_num = *db_header_root_page(get_page(pager, 0));
+    return t;
+}
+
+/*
+    Hands the part of a page's slot past its compressed frame back to the filesystem. This is best
+    effort: where holes cannot be punched the stale bytes stay, and since readers stop at the end of
+    the frame nothing ever looks at them.
+*/
+void pager_release_slot_tail(Pager* p, u32 page_num, u32 used)
+{
+#if !defined(PLATFORM_WINDOWS) && defined(FALLOC_FL_PUNCH_HOLE)
+    u32 start = (used + PAGE_FRAME_BLOCK_SIZE - 1) / PAGE_FRAME_BLOCK_SIZE * PAGE_FRAME_BLOCK_SIZE;
+    if (start < p->page_size) {
+        fallocate(p->file_descriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)page_num * p->page_size + start, p->page_size - start);
+    }
+#endif
+}
+
+// Compressed frames are shorter than their slot, this makes sure the file still ends on a whole page
+bool file_set_length(int fd, u64 length)
+{
+#ifdef PLATFORM_WINDOWS
+    return _chsize_s(fd, length) == 0;
+#else
+    return ftruncate(fd, (off_t)length) == 0;
+#endif
+}
+
+// Buffers for the frames of up to pages_count compressed pages, NULL when the pager does not compress
+u8* pager_alloc_frame_buffers(Pager* p, u32 pages_count)
+{
+    if (!p->compress_pages || pages_count == 0) {
+        return NULL;
+    }
+    u8* buffers = malloc((size_t)pages_count * p->page_size);
+    if (!buffers) {
+        printf("Error allocating buffers for %u compressed pages.\n", pages_count);
+        exit(EXIT_FAILURE);
+    }
+    return buffers;
+}
+
+// Writes every dirty page back as a single batch of asynchronous writes and waits for all of them
+void pager_flush(Pager* p)
+{
+    if (p->file_descriptor == -1) {
+        return;
+    }
+    PageIoRequest writes[TABLE_MAX_PAGES];
+    u32 writes_count = 0;
+    // Compressed frames have to stay alive until their write completes
+    u8* frames = pager_alloc_frame_buffers(p, pager_dirty_pages_count(p));
+    u64 file_length = p->file_length;
+
+    // Prefetches share the queue, let them land before reusing it for writes
+    page_io_wait_all(p->io);
+    for (u32 i = 0; i < p->pages_count; i++) {
+        if (p->reading[i]) {
+            pager_finish_read(p, i);
+        }
+        if (!p->dirty[i]) {
+            continue;
+        }
+        if (!p->pages[i]) {
+            printf("Tried to flush a null page.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        PageIoRequest* w = &writes[writes_count];
+        w->fd = p->file_descriptor;
+        w->is_write = true;
+        w->buffer = pager_encode_page(p, i, frames ? frames + (size_t)writes_count * p->page_size : NULL, &w->size);
+        w->offset = (u64)i * p->page_size;
+        page_io_submit(p->io, w);
+        writes_count++;
+    }
+    page_io_wait_all(p->io);
+
+    for (u32 i = 0; i < writes_count; i++) {
+        PageIoRequest* w = &writes[i];
+        if (w->result != w->size) {
+            printf("Error writing: %d\n", w->result < 0 ? (i32)-w->result : 0);
+            exit(EXIT_FAILURE);
+        }
+        u32 page_num = w->offset / p->page_size;
+        p->dirty[page_num] = false;
+        p->changed_since_backup[page_num] = true;
+        if (w->size < p->page_size) {
+            pager_release_slot_tail(p, page_num, w->size);
+        }
+        if (w->offset + p->page_size > p->file_length) {
+            p->file_length = w->offset + p->page_size;
+        }
+        p->stats.bytes_written += w->size;
+        p->stats.pages_flushed++;
+    }
+    free(frames);
+    if (p->compress_pages && p->file_length > file_length && !file_set_length(p->file_descriptor, p->file_length)) {
+        printf("Error extending db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void pager_update_header(Pager* p)
+{
+    u32* header_pages_count = db_header_pages_count(get_page(p, 0));
+    if (*header_pages_count != p->pages_count) {
+        *header_pages_count = p->pages_count;
+        pager_mark_dirty(p, 0);
+    }
+}
+
+// Brings the file up to date with the cache, header included, so it can be read on its own
+void pager_checkpoint(Pager* p)
+{
+    pager_update_header(p);
+    pager_flush(p);
+}
+
+/*
+    Copies the database to path while it stays open. Dirty pages are flushed first so the file is
+    consistent, then the copy happens in the kernel (see file_copy_range). Backing up to the same path
+    as the previous backup of this session only copies the pages written since then, as long as the
+    destination still has the length that backup left it with. Anything else gets a full copy.
+    Returns false after printing an error, the database itself is never affected.
+*/
+bool db_backup(Table* t, const char* path, BackupInfo* info)
+{
+    assert(t && path && info && "Must provide valid ptrs to db_backup");
+    Pager* p = t->pager;
+    if (p->file_descriptor == -1) {
+        printf("In-memory databases have no file to back up, use .save instead.\n");
+        return false;
+    }
+    pager_checkpoint(p);
+
+#ifdef PLATFORM_WINDOWS
+    int dst_fd = _open(path, _O_WRONLY | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    struct _stat64 dst_stat;
+    bool stat_ok = dst_fd != -1 && _fstat64(dst_fd, &dst_stat) == 0;
+#else
+    int dst_fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+    struct stat dst_stat;
+    bool stat_ok = dst_fd != -1 && fstat(dst_fd, &dst_stat) == 0;
+#endif
+    if (!stat_ok) {
+        printf("Error opening backup file '%s': %d\n", path, errno);
+        if (dst_fd != -1) {
+#ifdef PLATFORM_WINDOWS
+            _close(dst_fd);
+#else
+            close(dst_fd);
+#endif
+        }
+        return false;
+    }
+
+    info->incremental = p->last_backup_path && strcmp(p->last_backup_path, path) == 0 &&
+                        (u64)dst_stat.st_size == p->last_backup_length;
+    info->pages_count = p->pages_count;
+    info->pages_copied = 0;
+    info->method = FILE_COPY_REFLINK;
+
+    bool ok = true;
+    if (!info->incremental) {
+#ifdef PLATFORM_WINDOWS
+        ok = _chsize_s(dst_fd, 0) == 0;
+#else
+        ok = ftruncate(dst_fd, 0) == 0;
+#endif
+        ok = ok && file_copy_range(p->file_descriptor, dst_fd, 0, p->file_length, &info->method);
+        info->pages_copied = p->pages_count;
+    } else {
+        // Copy each run of consecutive changed pages in one call
+        for (u32 start = 0; ok && start < p->pages_count;) {
+            if (!p->changed_since_backup[start]) {
+                start++;
+                continue;
+            }
+            u32 end = start;
+            while (end < p->pages_count && p->changed_since_backup[end]) {
+                end++;
+            }
+            ok = file_copy_range(p->file_descriptor, dst_fd, (u64)start * p->page_size,
+                                 (u64)(end - start) * p->page_size, &info->method);
+            info->pages_copied += end - start;
+            start = end;
+        }
+    }
+#ifdef PLATFORM_WINDOWS
+    ok = ok && _chsize_s(dst_fd, p->file_length) == 0 && _commit(dst_fd) == 0;
+    ok = _close(dst_fd) == 0 && ok;
+#else
+    ok = ok && ftruncate(dst_fd, p->file_length) == 0 && fsync(dst_fd) == 0;
+    ok = close(dst_fd) == 0 && ok;
+#endif
+    if (!ok) {
+        printf("Error writing backup file '%s': %d\n", path, errno);
+        // The destination is in an unknown state, the next backup to it has to be a full one
+        free(p->last_backup_path);
+        p->last_backup_path = NULL;
+        return false;
+    }
+
+    memset(p->changed_since_backup, 0, sizeof(p->changed_since_backup));
+    if (!info->incremental) {
+        free(p->last_backup_path);
+        p->last_backup_path = strdup(path);
+    }
+    p->last_backup_length = p->file_length;
+    return true;
+}
+
+/*
+    Writes every page of the database to a new file at path, in the regular on-disk format, straight
+    from the page cache. This is how an in-memory database gets persisted, and it works the same for
+    file backed ones. An existing file at path is replaced.
+    Returns false after printing an error, the database itself is never affected.
+*/
+bool db_save(Table* t, const char* path)
+{
+    assert(t && path && "Must provide valid ptrs to db_save");
+    Pager* p = t->pager;
+    pager_update_header(p);
+    // Pages that are only on disk are pulled into the cache first, writes need them in memory anyway
+    for (u32 i = 0; i < p->pages_count; i++) {
+        get_page(p, i);
+    }
+
+#ifdef PLATFORM_WINDOWS
+    int fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+#endif
+    if (fd == -1) {
+        printf("Error opening snapshot file '%s': %d\n", path, errno);
+        return false;
+    }
+
+    PageIoRequest writes[TABLE_MAX_PAGES];
+    // The file starts out empty, so the slot space after a compressed frame is a hole from the start
+    u8* frames = pager_alloc_frame_buffers(p, p->pages_count);
+    page_io_wait_all(p->io);
+    for (u32 i = 0; i < p->pages_count; i++) {
+        PageIoRequest* w = &writes[i];
+        w->fd = fd;
+        w->is_write = true;
+        w->buffer = pager_encode_page(p, i, frames ? frames + (size_t)i * p->page_size : NULL, &w->size);
+        w->offset = (u64)i * p->page_size;
+        page_io_submit(p->io, w);
+    }
+    page_io_wait_all(p->io);
+    free(frames);
+
+    bool ok = true;
+    for (u32 i = 0; i < p->pages_count; i++) {
+        if (writes[i].result != writes[i].size) {
+            errno = writes[i].result < 0 ? (i32)-writes[i].result : EIO;
+            ok = false;
+        }
+    }
+    ok = ok && file_set_length(fd, (u64)p->pages_count * p->page_size);
+#ifdef PLATFORM_WINDOWS
+    ok = ok && _commit(fd) == 0;
+    ok = _close(fd) == 0 && ok;
+#else
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+#endif
+    if (!ok) {
+        printf("Error writing snapshot file '%s': %d\n", path, errno);
+        return false;
+    }
+    return true;
+}
+
+void db_close(Table* t)
+{
+    assert(t && "Must provide a valid Table ptr to db_close");
+    Pager* p = t->pager;
+
+    pager_checkpoint(p);
+    page_io_destroy(p->io);
+
+#ifdef PLATFORM_WINDOWS
+    if (p->file_descriptor != -1 && _close(p->file_descriptor) != 0) {
+#else
+    if (p->file_descriptor != -1 && close(p->file_descriptor) != 0) {
+#endif
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Every cached page lives in the arena, so releasing it frees them all at once
+    frame_arena_destroy(&p->frames);
+    free(p->packed_buffer);
+    free(p->last_backup_path);
+    free(p);
+    if (t->use_leaf_filters) {
+        bloom_filters_destroy(&t->leaf_filters);
+    }
+    row_cache_destroy(&t->row_cache);
+    free(t);
+}
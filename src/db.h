@@ -0,0 +1,259 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "bloom_filter.h"
+#include "file_copy.h"
+#include "frame_arena.h"
+#include "int_types.h"
+#include "page_io.h"
+#include "row_cache.h"
+
+/*
+    The storage engine: a single table of rows in a B-tree, paged to and from one database file.
+    The REPL in main.c and the replay tool drive it the same way, one text statement at a time
+    through prepare_statement and execute_statement.
+*/
+
+typedef struct {
+    char* data;
+    size_t count;
+    size_t capacity;
+} StringBuilder;
+
+typedef enum {
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_UPDATE
+} StatementType;
+
+typedef enum {
+    META_COMMAND_SUCCESS,
+    META_COMMAND_EXIT,
+    META_COMMAND_UNKNOWN_COMMAND
+} MetaCommandResult;
+
+typedef enum {
+    PREPARE_SUCCESS,
+    PREPARE_NEGATIVE_ID,
+    PREPARE_ID_TOO_BIG,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_UNRECOGNIZED_STATEMENT
+} PrepareResult;
+
+typedef enum {
+    EXECUTE_SUCCESS,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_KEY_NOT_FOUND,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_FAILURE
+} ExecuteResult;
+
+typedef enum {
+    KEY_TYPE_U32,
+    KEY_TYPE_U64,
+    // (tenant, id) pairs, ordered by tenant first
+    KEY_TYPE_COMPOSITE,
+    KEY_TYPES_COUNT
+} KeyType;
+
+// In memory form shared by every key type, integer keys leave tenant at 0
+typedef struct {
+    u64 tenant;
+    u64 id;
+} Key;
+
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+typedef struct {
+    Key key;
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+} Row;
+
+typedef enum {
+    // Primary key order, which is the order of the leaf chain and needs no sorting
+    ORDER_BY_KEY,
+    ORDER_BY_USERNAME,
+    ORDER_BY_EMAIL
+} OrderBy;
+
+typedef enum {
+    TEXT_MATCH_EQUALS,
+    // LIKE patterns of the form abc%, %abc and %abc% get their own kernels, everything else goes through text_like
+    TEXT_MATCH_PREFIX,
+    TEXT_MATCH_SUFFIX,
+    TEXT_MATCH_CONTAINS,
+    TEXT_MATCH_LIKE
+} TextMatchKind;
+
+// A where clause on username or email, checked against the serialized column without deserializing the row
+typedef struct {
+    bool enabled;
+    bool on_email;
+    TextMatchKind kind;
+    // The value to compare with, with the % of prefix, suffix and contains patterns stripped off
+    char needle[COLUMN_EMAIL_SIZE + 1];
+    u32 needle_length;
+} TextFilter;
+
+typedef struct {
+    StatementType type;
+    TextFilter filter;
+    OrderBy order_by;
+    bool descending;
+    // select where id = <key> looks up a single row
+    bool where_key;
+    // Inserts and updates carry their key and new values here
+    Row row_to_insert;
+    // insert or replace overwrites an existing row instead of failing with a duplicate key
+    bool replace;
+    // Which columns an update assigns, the others keep their stored value
+    bool update_username;
+    bool update_email;
+} Statement;
+
+#define INVALID_PAGE_NUM UINT32_MAX
+#define TABLE_MAX_PAGES 100
+// How many upcoming leaves a scan keeps in flight
+#define PAGE_PREFETCH_DEPTH 8
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+#define DEFAULT_SORT_MEMORY (64 * 1024 * 1024)
+// Opening this name gives a database that lives only in the page cache, with no file behind it
+#define MEMORY_DB_FILENAME ":memory:"
+
+typedef struct {
+    // Only used when creating a new database, existing files use the page size and key type stored in their header
+    u32 page_size;
+    KeyType key_type;
+    bool huge_pages;
+    // Falls back to the thread pool when false or when the kernel does not support io_uring
+    bool allow_io_uring;
+    // Memory an order by may use before spilling sorted runs to temporary files
+    size_t sort_memory;
+    // Keep a Bloom filter of every leaf's keys so lookups of missing keys can skip reading the leaf
+    bool bloom_filters;
+    // Memory for decoded rows served to select where id = <key>, zero disables the row cache
+    size_t row_cache_memory;
+    // Only used when creating a new database, whether pages are compressed is stored in the header
+    bool compress_pages;
+} DbOptions;
+
+// Bucket i counts samples in [2^i, 2^(i+1)) nanoseconds, the last bucket also holds everything above
+#define LATENCY_BUCKETS_COUNT 40
+#define STATEMENT_TYPES_COUNT 3
+
+typedef struct {
+    u64 count;
+    u64 total_ns;
+    u64 max_ns;
+    u64 buckets[LATENCY_BUCKETS_COUNT];
+} LatencyHistogram;
+
+typedef struct {
+    u64 cache_hits;
+    u64 cache_misses;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 pages_flushed;
+    u64 pages_prefetched;
+} PagerStats;
+
+typedef struct {
+    u64 leaf_splits;
+    u64 internal_splits;
+    u64 root_splits;
+    u64 sort_runs_spilled;
+    u64 bloom_filter_skips;
+    u64 rightmost_appends;
+    LatencyHistogram statement_latency[STATEMENT_TYPES_COUNT];
+} TableStats;
+
+typedef struct {
+    // -1 for in-memory databases, which never read or write a file
+    int file_descriptor;
+    u64 file_length;
+    u32 page_size;
+    u32 pages_count;
+    // Cell layouts and node capacities depend on the key type and page size so they are derived when the pager is opened
+    KeyType key_type;
+    u32 key_size;
+    u32 row_size;
+    u32 leaf_node_cell_size;
+    u32 internal_node_cell_size;
+    u32 leaf_node_space_for_cells;
+    u32 leaf_node_max_cells;
+    u32 leaf_node_right_split_count;
+    u32 leaf_node_left_split_count;
+    void* pages[TABLE_MAX_PAGES];
+    // Pages that must be written back before they can be dropped
+    bool dirty[TABLE_MAX_PAGES];
+    // Prefetched pages have a frame in pages[] as soon as their read is submitted,
+    // get_page waits for the read to land before handing them out
+    bool reading[TABLE_MAX_PAGES];
+    PageIoRequest reads[TABLE_MAX_PAGES];
+    // Pages written to the file since the last backup, an incremental backup copies only these
+    bool changed_since_backup[TABLE_MAX_PAGES];
+    char* last_backup_path;
+    u64 last_backup_length;
+    PageIo* io;
+    FrameArena frames;
+    // Pages are compressed on their way to the file and decompressed into their frame, cached pages never are
+    bool compress_pages;
+    // Packed form of the page being compressed or decompressed, two pages long. NULL without compression
+    u8* packed_buffer;
+    PagerStats stats;
+} Pager;
+
+typedef struct {
+    bool incremental;
+    u32 pages_copied;
+    u32 pages_count;
+    // The cheapest copy method that worked for every page
+    FileCopyMethod method;
+} BackupInfo;
+
+typedef struct {
+    Pager* pager;
+    u32 root_page_num;
+    // Found on the first append and moved along by splits, INVALID_PAGE_NUM until then
+    u32 rightmost_leaf_page_num;
+    size_t sort_memory;
+    /*
+        One filter per leaf page, indexed by page number. They live only in memory and are built by
+        scanning the tree the first time a lookup needs them, then kept up to date on insert and split.
+        An active filter also tells a descent that the page is a leaf without reading it.
+    */
+    bool use_leaf_filters;
+    bool leaf_filters_built;
+    BloomFilters leaf_filters;
+    // Decoded rows by key for point lookups, any write to a key drops its entry
+    RowCache row_cache;
+    TableStats stats;
+} Table;
+
+Table* db_open(const char* filename, const DbOptions* options);
+// Writes everything back and frees the table
+void db_close(Table* t);
+
+// Handles a line starting with a dot
+MetaCommandResult do_meta_command(StringBuilder* sb, Table* t);
+// Parses the statement in sb, which it modifies in the process
+PrepareResult prepare_statement(StringBuilder* sb, Table* t, Statement* s);
+ExecuteResult execute_statement(Statement* s, Table* t);
+
+const char* statement_type_name(StatementType type);
+const char* key_type_name(KeyType type);
+bool is_valid_page_size(u32 page_size);
+
+DbOptions default_db_options();
+// Consumes the command line option at argv[*i] and its value if it is one of the database's, exits on a bad value
+bool parse_db_option(i32 argc, char** argv, i32* i, DbOptions* options);
+
+// Monotonic clock for timing statements
+u64 now_ns();
+void latency_histogram_record(LatencyHistogram* h, u64 ns);
+u64 latency_histogram_percentile(LatencyHistogram* h, u32 percentile);
@@ -0,0 +1,162 @@
+// Keep off_t 64 bits wide on 32-bit targets too
+#define _FILE_OFFSET_BITS 64
+// copy_file_range is a GNU extension
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+#include "file_copy.h"
+
+#define READ_WRITE_CHUNK_SIZE (1024 * 1024)
+
+#ifndef PLATFORM_WINDOWS
+// Errors that mean the method is not available for these files rather than that the copy failed
+static bool is_unsupported(int error)
+{
+    return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP ||
+           error == ENOTTY || error == EBADF;
+}
+
+static bool copy_with_reflink(int src_fd, int dst_fd, u64 offset, u64 length)
+{
+#ifdef FICLONERANGE
+    struct file_clone_range range = {
+        .src_fd = src_fd,
+        .src_offset = offset,
+        .src_length = length,
+        .dest_offset = offset,
+    };
+    return ioctl(dst_fd, FICLONERANGE, &range) == 0;
+#else
+    errno = EOPNOTSUPP;
+    return false;
+#endif
+}
+
+static bool copy_with_copy_file_range(int src_fd, int dst_fd, u64 offset, u64 length)
+{
+    loff_t src_offset = offset;
+    loff_t dst_offset = offset;
+    while (length > 0) {
+        ssize_t copied = copy_file_range(src_fd, &src_offset, dst_fd, &dst_offset, length, 0);
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (copied == 0) {
+            errno = EIO;
+            return false;
+        }
+        length -= copied;
+    }
+    return true;
+}
+
+// sendfile writes at the destination's file position, so it has to be moved there first
+static bool copy_with_sendfile(int src_fd, int dst_fd, u64 offset, u64 length)
+{
+    if (lseek(dst_fd, offset, SEEK_SET) < 0) {
+        return false;
+    }
+    off_t src_offset = offset;
+    while (length > 0) {
+        ssize_t copied = sendfile(dst_fd, src_fd, &src_offset, length);
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (copied == 0) {
+            errno = EIO;
+            return false;
+        }
+        length -= copied;
+    }
+    return true;
+}
+#endif
+
+static bool copy_with_read_write(int src_fd, int dst_fd, u64 offset, u64 length)
+{
+    u8* buffer = malloc(READ_WRITE_CHUNK_SIZE);
+    if (!buffer) {
+        errno = ENOMEM;
+        return false;
+    }
+    bool ok = true;
+    while (ok && length > 0) {
+        u32 chunk = length < READ_WRITE_CHUNK_SIZE ? (u32)length : READ_WRITE_CHUNK_SIZE;
+#ifdef PLATFORM_WINDOWS
+        ok = _lseeki64(src_fd, offset, SEEK_SET) >= 0 && _read(src_fd, buffer, chunk) == (int)chunk &&
+             _lseeki64(dst_fd, offset, SEEK_SET) >= 0 && _write(dst_fd, buffer, chunk) == (int)chunk;
+#else
+        ok = pread(src_fd, buffer, chunk, offset) == chunk && pwrite(dst_fd, buffer, chunk, offset) == chunk;
+#endif
+        if (ok) {
+            offset += chunk;
+            length -= chunk;
+        } else if (errno == 0) {
+            errno = EIO;
+        }
+    }
+    free(buffer);
+    return ok;
+}
+
+bool file_copy_range(int src_fd, int dst_fd, u64 offset, u64 length, FileCopyMethod* method)
+{
+    assert(method && "Must provide a FileCopyMethod to file_copy_range");
+    if (length == 0) {
+        return true;
+    }
+#ifdef PLATFORM_WINDOWS
+    *method = FILE_COPY_READ_WRITE;
+#else
+    for (;;) {
+        bool ok;
+        switch (*method) {
+            case FILE_COPY_REFLINK: ok = copy_with_reflink(src_fd, dst_fd, offset, length); break;
+            case FILE_COPY_COPY_FILE_RANGE: ok = copy_with_copy_file_range(src_fd, dst_fd, offset, length); break;
+            case FILE_COPY_SENDFILE: ok = copy_with_sendfile(src_fd, dst_fd, offset, length); break;
+            default: ok = copy_with_read_write(src_fd, dst_fd, offset, length); break;
+        }
+        if (ok) {
+            return true;
+        }
+        // A method that fails part way may already have copied some bytes, but every method starts over from offset
+        if (*method == FILE_COPY_READ_WRITE || !is_unsupported(errno)) {
+            return false;
+        }
+        (*method)++;
+    }
+#endif
+    return copy_with_read_write(src_fd, dst_fd, offset, length);
+}
+
+const char* file_copy_method_name(FileCopyMethod method)
+{
+    switch (method) {
+        case FILE_COPY_REFLINK: return "reflink";
+        case FILE_COPY_COPY_FILE_RANGE: return "copy_file_range";
+        case FILE_COPY_SENDFILE: return "sendfile";
+        case FILE_COPY_READ_WRITE: return "read/write";
+        default:
+            assert(false && "Invalid method in file_copy_method_name");
+            return "unknown";
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "int_types.h"
+
+// Ordered from cheapest to most expensive, a copy only ever moves down the list
+typedef enum {
+    FILE_COPY_REFLINK,
+    FILE_COPY_COPY_FILE_RANGE,
+    FILE_COPY_SENDFILE,
+    FILE_COPY_READ_WRITE
+} FileCopyMethod;
+
+/*
+    Copies length bytes at offset from one file to the same offset in another, keeping the data in
+    the kernel where possible. A reflink shares the extents outright on filesystems that support it,
+    copy_file_range and sendfile move the bytes without a round trip through user space, and plain
+    positional reads and writes are the last resort.
+    method is where the copy starts and is lowered to whatever actually worked, so passing the
+    result of one call into the next skips methods already known to fail. Reflinks need offset and
+    length aligned to the filesystem block size.
+    Returns false and sets errno if the copy failed.
+*/
+bool file_copy_range(int src_fd, int dst_fd, u64 offset, u64 length, FileCopyMethod* method);
+const char* file_copy_method_name(FileCopyMethod method);
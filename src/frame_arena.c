@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "frame_arena.h"
+
+#define HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+#ifndef PLATFORM_WINDOWS
+static void* map_region(size_t size, int extra_flags)
+{
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    return mapping == MAP_FAILED ? NULL : mapping;
+}
+#endif
+
+void frame_arena_init(FrameArena* a, u32 frame_size, u32 frames_capacity, bool use_huge_pages)
+{
+    assert(a && frame_size > 0 && "Must provide a valid FrameArena and frame size");
+    assert((frame_size & (frame_size - 1)) == 0 && "Frame size must be a power of two");
+
+    memset(a, 0, sizeof(*a));
+    a->frame_size = frame_size;
+    a->frames_capacity = frames_capacity;
+
+    size_t frames_size = (size_t)frame_size * frames_capacity;
+    size_t alignment = frame_size;
+
+#ifdef PLATFORM_WINDOWS
+    (void)use_huge_pages;
+    a->backing = FRAME_ARENA_REGULAR_PAGES;
+    a->mapping_size = frames_size;
+    a->mapping = _aligned_malloc(frames_size, alignment);
+    a->frames = a->mapping;
+#else
+    if (use_huge_pages) {
+        // Explicit huge pages only work when the administrator reserved them, otherwise fall back to THP
+        a->mapping_size = align_up(frames_size, HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+        a->mapping = map_region(a->mapping_size, MAP_HUGETLB);
+#endif
+        if (a->mapping) {
+            a->backing = FRAME_ARENA_EXPLICIT_HUGE_PAGES;
+            a->frames = a->mapping;
+        }
+    }
+
+    if (!a->mapping) {
+        size_t usable_size = frames_size;
+        bool want_transparent = use_huge_pages;
+#ifndef MADV_HUGEPAGE
+        want_transparent = false;
+#endif
+        if (want_transparent) {
+            // Only whole aligned huge pages inside the mapping can be backed by one, so round the region up to them
+            usable_size = align_up(frames_size, HUGE_PAGE_SIZE);
+            if (alignment < HUGE_PAGE_SIZE) {
+                alignment = HUGE_PAGE_SIZE;
+            }
+        }
+        // mmap only guarantees OS page alignment, reserve some slack to align the frames ourselves
+        a->mapping_size = usable_size + alignment;
+        a->mapping = map_region(a->mapping_size, 0);
+        a->frames = a->mapping ? (u8*)align_up((size_t)a->mapping, alignment) : NULL;
+        a->backing = FRAME_ARENA_REGULAR_PAGES;
+#ifdef MADV_HUGEPAGE
+        if (a->mapping && want_transparent && madvise(a->frames, usable_size, MADV_HUGEPAGE) == 0) {
+            a->backing = FRAME_ARENA_TRANSPARENT_HUGE_PAGES;
+        }
+#endif
+    }
+#endif
+
+    if (!a->mapping) {
+        printf("Error reserving %zu bytes for page frames.\n", frames_size);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void* frame_arena_alloc(FrameArena* a)
+{
+    if (a->frames_allocated >= a->frames_capacity) {
+        return NULL;
+    }
+    return a->frames + (size_t)a->frame_size * a->frames_allocated++;
+}
+
+void frame_arena_destroy(FrameArena* a)
+{
+    if (!a->mapping) {
+        return;
+    }
+#ifdef PLATFORM_WINDOWS
+    _aligned_free(a->mapping);
+#else
+    munmap(a->mapping, a->mapping_size);
+#endif
+    memset(a, 0, sizeof(*a));
+}
+
+const char* frame_arena_backing_name(FrameArenaBacking backing)
+{
+    switch (backing) {
+        case FRAME_ARENA_REGULAR_PAGES: return "regular pages";
+        case FRAME_ARENA_TRANSPARENT_HUGE_PAGES: return "transparent huge pages";
+        case FRAME_ARENA_EXPLICIT_HUGE_PAGES: return "explicit huge pages";
+        default:
+            assert(false && "Invalid backing in frame_arena_backing_name");
+            return "unknown";
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "int_types.h"
+
+typedef enum {
+    FRAME_ARENA_REGULAR_PAGES,
+    FRAME_ARENA_TRANSPARENT_HUGE_PAGES,
+    FRAME_ARENA_EXPLICIT_HUGE_PAGES
+} FrameArenaBacking;
+
+/*
+    Hands out fixed size page frames from one contiguous region reserved up front.
+    Frames are aligned to the frame size, which keeps them usable for direct I/O,
+    and packing them together lets huge pages cover many frames per TLB entry.
+    The pager keeps every page it loads, so frames are only returned all at once.
+*/
+typedef struct {
+    void* mapping;
+    size_t mapping_size;
+    u8* frames;
+    u32 frame_size;
+    u32 frames_capacity;
+    u32 frames_allocated;
+    FrameArenaBacking backing;
+} FrameArena;
+
+void frame_arena_init(FrameArena* a, u32 frame_size, u32 frames_capacity, bool use_huge_pages);
+// Returns NULL once every frame is in use. Contents of the returned frame are undefined
+void* frame_arena_alloc(FrameArena* a);
+void frame_arena_destroy(FrameArena* a);
+const char* frame_arena_backing_name(FrameArenaBacking backing);
@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include "lz_codec.h"
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+// Literal and match lengths share the token byte a nibble each, this value means more length bytes follow
+#define NIBBLE_MAX 15
+
+static u32 read_u32(const u8* p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static u32 hash_u32(u32 value)
+{
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths that overflow their nibble continue as bytes of 255 ended by one smaller byte
+static bool write_length(u8** op, const u8* end, u32 length)
+{
+    while (length >= 255) {
+        if (*op >= end) {
+            return false;
+        }
+        *(*op)++ = 255;
+        length -= 255;
+    }
+    if (*op >= end) {
+        return false;
+    }
+    *(*op)++ = (u8)length;
+    return true;
+}
+
+static bool read_length(const u8** ip, const u8* end, u64* length)
+{
+    u8 byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// A match_length of 0 ends the stream, the last sequence is literals only
+static bool write_sequence(u8** op, const u8* end, const u8* literals, u32 literals_length, u32 offset, u32 match_length)
+{
+    u32 match_code = match_length ? match_length - MIN_MATCH : 0;
+    if (*op >= end) {
+        return false;
+    }
+    *(*op)++ = (u8)(((literals_length < NIBBLE_MAX ? literals_length : NIBBLE_MAX) << 4) |
+                    (match_code < NIBBLE_MAX ? match_code : NIBBLE_MAX));
+    if (literals_length >= NIBBLE_MAX && !write_length(op, end, literals_length - NIBBLE_MAX)) {
+        return false;
+    }
+    if ((size_t)(end - *op) < literals_length) {
+        return false;
+    }
+    memcpy(*op, literals, literals_length);
+    *op += literals_length;
+    if (match_length == 0) {
+        return true;
+    }
+
+    if (end - *op < 2) {
+        return false;
+    }
+    *(*op)++ = (u8)offset;
+    *(*op)++ = (u8)(offset >> 8);
+    return match_code < NIBBLE_MAX || write_length(op, end, match_code - NIBBLE_MAX);
+}
+
+u32 lz_compress(const u8* src, u32 length, u8* dst, u32 capacity)
+{
+    // Last position seen for each hash, plus one so zero means empty
+    u32 table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    u8* op = dst;
+    const u8* end = dst + capacity;
+    u32 anchor = 0;
+    u32 i = 0;
+    while (length >= MIN_MATCH && i <= length - MIN_MATCH) {
+        u32 h = hash_u32(read_u32(src + i));
+        u32 candidate = table[h];
+        table[h] = i + 1;
+        if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET || read_u32(src + candidate - 1) != read_u32(src + i)) {
+            i++;
+            continue;
+        }
+        candidate--;
+
+        u32 match_length = MIN_MATCH;
+        while (i + match_length < length && src[candidate + match_length] == src[i + match_length]) {
+            match_length++;
+        }
+        if (!write_sequence(&op, end, src + anchor, i - anchor, i - candidate, match_length)) {
+            return 0;
+        }
+        i += match_length;
+        anchor = i;
+    }
+    if (!write_sequence(&op, end, src + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+    return (u32)(op - dst);
+}
+
+bool lz_decompress(const u8* src, u32 length, u8* dst, u32 dst_length)
+{
+    const u8* ip = src;
+    const u8* end = src + length;
+    u32 out = 0;
+    while (ip < end) {
+        u8 token = *ip++;
+        u64 literals_length = token >> 4;
+        if (literals_length == NIBBLE_MAX && !read_length(&ip, end, &literals_length)) {
+            return false;
+        }
+        if ((u64)(end - ip) < literals_length || dst_length - out < literals_length) {
+            return false;
+        }
+        memcpy(dst + out, ip, literals_length);
+        ip += literals_length;
+        out += (u32)literals_length;
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        u32 offset = ip[0] | ((u32)ip[1] << 8);
+        ip += 2;
+        u64 match_length = token & NIBBLE_MAX;
+        if (match_length == NIBBLE_MAX && !read_length(&ip, end, &match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || offset > out || dst_length - out < match_length) {
+            return false;
+        }
+        // Byte by byte on purpose, a match may overlap the bytes it is producing
+        for (u32 k = 0; k < match_length; k++) {
+            dst[out + k] = dst[out + k - offset];
+        }
+        out += (u32)match_length;
+    }
+    return out == dst_length;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "int_types.h"
+
+/*
+    Small byte oriented LZ77 codec in the spirit of LZ4, used to compress pages on their way to
+    disk. Input is a series of sequences, each a run of literals followed by a back reference of at
+    least four bytes into the previous 64KiB of output. It favours speed over ratio: one hash probe
+    per position, no entropy coding. Works on buffers up to 4GiB but is meant for single pages.
+*/
+
+// Worst case output size for length bytes of input
+#define LZ_COMPRESS_BOUND(length) ((length) + (length) / 255 + 16)
+
+// Returns the compressed size, or 0 if it would not fit in capacity
+u32 lz_compress(const u8* src, u32 length, u8* dst, u32 capacity);
+// Fails on malformed input or if it does not decode to exactly dst_length bytes, never writing outside dst
+bool lz_decompress(const u8* src, u32 length, u8* dst, u32 dst_length);
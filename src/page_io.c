@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <io.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "page_io.h"
+
+#define PAGE_IO_QUEUE_DEPTH 64
+#define PAGE_IO_THREADS_COUNT 4
+
+struct PageIo {
+    PageIoBackend backend;
+    // Guarded by lock while pool workers are running
+    u32 in_flight;
+    // Requests submitted since the last kick
+    PageIoRequest* pending_head;
+    PageIoRequest* pending_tail;
+    u32 pending_count;
+
+#ifdef __linux__
+    int ring_fd;
+    u32 ring_entries;
+    u32 cq_entries;
+    u32 to_submit;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_ring_mask;
+    u32* sq_array;
+    u32* cq_head;
+    u32* cq_tail;
+    u32* cq_ring_mask;
+    struct io_uring_cqe* cqes;
+#endif
+
+#ifndef PLATFORM_WINDOWS
+    pthread_t threads[PAGE_IO_THREADS_COUNT];
+    u32 threads_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    PageIoRequest* queue_head;
+    PageIoRequest* queue_tail;
+    bool stopping;
+#endif
+};
+
+// Runs a whole request with blocking positional I/O, used by the pool workers and to finish short transfers
+static i64 transfer(PageIoRequest* r)
+{
+    u64 total = 0;
+    while (total < r->size) {
+#ifdef PLATFORM_WINDOWS
+        i64 result = -1;
+        if (_lseeki64(r->fd, (i64)(r->offset + total), SEEK_SET) >= 0) {
+            result = r->is_write ? _write(r->fd, (u8*)r->buffer + total, (unsigned)(r->size - total))
+                                 : _read(r->fd, (u8*)r->buffer + total, (unsigned)(r->size - total));
+        }
+#else
+        ssize_t result = r->is_write ? pwrite(r->fd, (u8*)r->buffer + total, r->size - total, (off_t)(r->offset + total))
+                                     : pread(r->fd, (u8*)r->buffer + total, r->size - total, (off_t)(r->offset + total));
+#endif
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (result == 0) {
+            // End of file on reads
+            break;
+        }
+        total += result;
+    }
+    return (i64)total;
+}
+
+#ifdef __linux__
+static int io_uring_setup(u32 entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, u32 to_submit, u32 min_complete, u32 flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static bool uring_init(PageIo* io)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    io->ring_fd = io_uring_setup(PAGE_IO_QUEUE_DEPTH, &params);
+    if (io->ring_fd < 0) {
+        return false;
+    }
+    // IORING_OP_READ and IORING_OP_WRITE arrived in the same kernel release as this feature flag
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(io->ring_fd);
+        return false;
+    }
+
+    io->ring_entries = params.sq_entries;
+    io->cq_entries = params.cq_entries;
+    io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && io->cq_ring_size > io->sq_ring_size) {
+        io->sq_ring_size = io->cq_ring_size;
+    }
+
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       io->ring_fd, IORING_OFF_SQ_RING);
+    if (io->sq_ring == MAP_FAILED) {
+        close(io->ring_fd);
+        return false;
+    }
+    if (single_mmap) {
+        io->cq_ring = io->sq_ring;
+        io->cq_ring_size = 0;
+    } else {
+        io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           io->ring_fd, IORING_OFF_CQ_RING);
+        if (io->cq_ring == MAP_FAILED) {
+            munmap(io->sq_ring, io->sq_ring_size);
+            close(io->ring_fd);
+            return false;
+        }
+    }
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    io->ring_fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        if (io->cq_ring_size) {
+            munmap(io->cq_ring, io->cq_ring_size);
+        }
+        munmap(io->sq_ring, io->sq_ring_size);
+        close(io->ring_fd);
+        return false;
+    }
+
+    u8* sq = io->sq_ring;
+    io->sq_head = (u32*)(sq + params.sq_off.head);
+    io->sq_tail = (u32*)(sq + params.sq_off.tail);
+    io->sq_ring_mask = (u32*)(sq + params.sq_off.ring_mask);
+    io->sq_array = (u32*)(sq + params.sq_off.array);
+    u8* cq = io->cq_ring;
+    io->cq_head = (u32*)(cq + params.cq_off.head);
+    io->cq_tail = (u32*)(cq + params.cq_off.tail);
+    io->cq_ring_mask = (u32*)(cq + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    io->to_submit = 0;
+    return true;
+}
+
+static void uring_reap(PageIo* io)
+{
+    u32 head = *io->cq_head;
+    u32 tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &io->cqes[head & *io->cq_ring_mask];
+        PageIoRequest* r = (PageIoRequest*)(uintptr_t)cqe->user_data;
+        r->result = cqe->res;
+        if (r->result > 0 && r->result < r->size) {
+            // Short transfers are rare enough that finishing them synchronously is fine
+            PageIoRequest rest = *r;
+            rest.buffer = (u8*)r->buffer + r->result;
+            rest.offset = r->offset + r->result;
+            rest.size = r->size - (u32)r->result;
+            i64 rest_result = transfer(&rest);
+            r->result = rest_result < 0 ? rest_result : r->result + rest_result;
+        }
+        r->completed = true;
+        io->in_flight--;
+        head++;
+    }
+    __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_enter(PageIo* io, u32 min_complete)
+{
+    u32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = io_uring_enter(io->ring_fd, io->to_submit, min_complete, flags);
+    if (submitted < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return;
+        }
+        printf("Error submitting page I/O: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    io->to_submit -= submitted;
+}
+
+static void uring_queue(PageIo* io, PageIoRequest* r)
+{
+    u32 tail = *io->sq_tail;
+    // Never have more requests out than completion slots, and wait for room in a full submission ring
+    while (io->in_flight >= io->cq_entries || tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE) >= io->ring_entries) {
+        uring_enter(io, io->in_flight > 0 ? 1 : 0);
+        uring_reap(io);
+    }
+
+    u32 index = tail & *io->sq_ring_mask;
+    struct io_uring_sqe* sqe = &io->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->addr = (u64)(uintptr_t)r->buffer;
+    sqe->len = r->size;
+    sqe->off = r->offset;
+    sqe->user_data = (u64)(uintptr_t)r;
+    io->sq_array[index] = index;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->to_submit++;
+    io->in_flight++;
+}
+
+static void uring_destroy(PageIo* io)
+{
+    munmap(io->sqes, io->sqes_size);
+    if (io->cq_ring_size) {
+        munmap(io->cq_ring, io->cq_ring_size);
+    }
+    munmap(io->sq_ring, io->sq_ring_size);
+    close(io->ring_fd);
+}
+#endif
+
+#ifndef PLATFORM_WINDOWS
+static void* pool_worker(void* arg)
+{
+    PageIo* io = arg;
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        while (!io->queue_head && !io->stopping) {
+            pthread_cond_wait(&io->work_ready, &io->lock);
+        }
+        if (!io->queue_head) {
+            break;
+        }
+        PageIoRequest* r = io->queue_head;
+        io->queue_head = r->next;
+        if (!io->queue_head) {
+            io->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&io->lock);
+
+        i64 result = transfer(r);
+
+        pthread_mutex_lock(&io->lock);
+        r->result = result;
+        r->completed = true;
+        io->in_flight--;
+        pthread_cond_broadcast(&io->work_done);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+static bool pool_init(PageIo* io)
+{
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->work_ready, NULL);
+    pthread_cond_init(&io->work_done, NULL);
+    io->queue_head = NULL;
+    io->queue_tail = NULL;
+    io->stopping = false;
+    io->threads_count = 0;
+    for (u32 i = 0; i < PAGE_IO_THREADS_COUNT; i++) {
+        if (pthread_create(&io->threads[i], NULL, pool_worker, io) != 0) {
+            break;
+        }
+        io->threads_count++;
+    }
+    return io->threads_count > 0;
+}
+
+static void pool_destroy(PageIo* io)
+{
+    pthread_mutex_lock(&io->lock);
+    io->stopping = true;
+    pthread_cond_broadcast(&io->work_ready);
+    pthread_mutex_unlock(&io->lock);
+    for (u32 i = 0; i < io->threads_count; i++) {
+        pthread_join(io->threads[i], NULL);
+    }
+    pthread_cond_destroy(&io->work_done);
+    pthread_cond_destroy(&io->work_ready);
+    pthread_mutex_destroy(&io->lock);
+}
+#endif
+
+PageIo* page_io_create(bool allow_io_uring)
+{
+    PageIo* io = malloc(sizeof(PageIo));
+    assert(io && "Out of ram lol");
+    memset(io, 0, sizeof(*io));
+
+#ifdef __linux__
+    if (allow_io_uring && uring_init(io)) {
+        io->backend = PAGE_IO_BACKEND_IO_URING;
+        return io;
+    }
+#else
+    (void)allow_io_uring;
+#endif
+
+#ifndef PLATFORM_WINDOWS
+    if (pool_init(io)) {
+        io->backend = PAGE_IO_BACKEND_THREAD_POOL;
+        return io;
+    }
+#endif
+    // Without worker threads requests simply run when they are kicked
+    io->backend = PAGE_IO_BACKEND_THREAD_POOL;
+    return io;
+}
+
+void page_io_destroy(PageIo* io)
+{
+    page_io_wait_all(io);
+#ifdef __linux__
+    if (io->backend == PAGE_IO_BACKEND_IO_URING) {
+        uring_destroy(io);
+        free(io);
+        return;
+    }
+#endif
+#ifndef PLATFORM_WINDOWS
+    pool_destroy(io);
+#endif
+    free(io);
+}
+
+PageIoBackend page_io_backend(PageIo* io)
+{
+    return io->backend;
+}
+
+const char* page_io_backend_name(PageIoBackend backend)
+{
+    switch (backend) {
+        case PAGE_IO_BACKEND_IO_URING: return "io_uring";
+        case PAGE_IO_BACKEND_THREAD_POOL: return "thread pool";
+        default:
+            assert(false && "Invalid backend in page_io_backend_name");
+            return "unknown";
+    }
+}
+
+void page_io_submit(PageIo* io, PageIoRequest* request)
+{
+    request->completed = false;
+    request->result = 0;
+    request->next = NULL;
+
+#ifdef __linux__
+    if (io->backend == PAGE_IO_BACKEND_IO_URING) {
+        uring_queue(io, request);
+        return;
+    }
+#endif
+    io->pending_count++;
+    if (io->pending_tail) {
+        io->pending_tail->next = request;
+    } else {
+        io->pending_head = request;
+    }
+    io->pending_tail = request;
+}
+
+void page_io_kick(PageIo* io)
+{
+#ifdef __linux__
+    if (io->backend == PAGE_IO_BACKEND_IO_URING) {
+        if (io->to_submit > 0) {
+            uring_enter(io, 0);
+        }
+        return;
+    }
+#endif
+    if (!io->pending_head) {
+        return;
+    }
+#ifndef PLATFORM_WINDOWS
+    if (io->threads_count > 0) {
+        pthread_mutex_lock(&io->lock);
+        if (io->queue_tail) {
+            io->queue_tail->next = io->pending_head;
+        } else {
+            io->queue_head = io->pending_head;
+        }
+        io->queue_tail = io->pending_tail;
+        io->in_flight += io->pending_count;
+        pthread_cond_broadcast(&io->work_ready);
+        pthread_mutex_unlock(&io->lock);
+        io->pending_head = NULL;
+        io->pending_tail = NULL;
+        io->pending_count = 0;
+        return;
+    }
+#endif
+    for (PageIoRequest* r = io->pending_head; r; r = r->next) {
+        r->result = transfer(r);
+        r->completed = true;
+    }
+    io->pending_head = NULL;
+    io->pending_tail = NULL;
+    io->pending_count = 0;
+}
+
+void page_io_wait(PageIo* io, PageIoRequest* request)
+{
+    page_io_kick(io);
+#ifdef __linux__
+    if (io->backend == PAGE_IO_BACKEND_IO_URING) {
+        uring_reap(io);
+        while (!request->completed) {
+            uring_enter(io, 1);
+            uring_reap(io);
+        }
+        return;
+    }
+#endif
+#ifndef PLATFORM_WINDOWS
+    if (io->threads_count > 0) {
+        pthread_mutex_lock(&io->lock);
+        while (!request->completed) {
+            pthread_cond_wait(&io->work_done, &io->lock);
+        }
+        pthread_mutex_unlock(&io->lock);
+    }
+#endif
+    assert(request->completed && "Waited on a request that was never submitted");
+}
+
+void page_io_wait_all(PageIo* io)
+{
+    page_io_kick(io);
+#ifdef __linux__
+    if (io->backend == PAGE_IO_BACKEND_IO_URING) {
+        uring_reap(io);
+        while (io->in_flight > 0) {
+            uring_enter(io, 1);
+            uring_reap(io);
+        }
+        return;
+    }
+#endif
+#ifndef PLATFORM_WINDOWS
+    if (io->threads_count > 0) {
+        pthread_mutex_lock(&io->lock);
+        while (io->in_flight > 0) {
+            pthread_cond_wait(&io->work_done, &io->lock);
+        }
+        pthread_mutex_unlock(&io->lock);
+    }
+#endif
+}
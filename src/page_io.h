@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "int_types.h"
+
+typedef enum {
+    PAGE_IO_BACKEND_IO_URING,
+    PAGE_IO_BACKEND_THREAD_POOL
+} PageIoBackend;
+
+typedef struct PageIoRequest {
+    int fd;
+    bool is_write;
+    void* buffer;
+    u32 size;
+    u64 offset;
+    // Bytes transferred, or a negative errno. Only valid once completed is set
+    i64 result;
+    bool completed;
+    struct PageIoRequest* next;
+} PageIoRequest;
+
+typedef struct PageIo PageIo;
+
+/*
+    Asynchronous page reads and writes. Requests are queued with page_io_submit and handed to
+    the kernel in one go by the next page_io_kick or wait call, so a batch of pages costs one
+    submission instead of one blocking call each. io_uring is used on Linux when the kernel allows
+    it, everything else goes through a small pool of threads doing positional I/O.
+    Requests must stay alive and untouched until they complete.
+*/
+PageIo* page_io_create(bool allow_io_uring);
+void page_io_destroy(PageIo* io);
+PageIoBackend page_io_backend(PageIo* io);
+const char* page_io_backend_name(PageIoBackend backend);
+
+void page_io_submit(PageIo* io, PageIoRequest* request);
+// Starts any queued requests without waiting for them
+void page_io_kick(PageIo* io);
+void page_io_wait(PageIo* io, PageIoRequest* request);
+void page_io_wait_all(PageIo* io);
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "row_cache.h"
+
+// Every slot starts with this header, followed by the key and then the value
+typedef struct {
+    u64 hash;
+    bool used;
+    // Set on every hit, cleared when the CLOCK hand passes
+    bool referenced;
+} SlotHeader;
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void row_cache_init(RowCache* c, u32 key_size, u32 value_size, size_t memory_budget)
+{
+    assert(c && "Must provide a valid RowCache");
+    memset(c, 0, sizeof(*c));
+    c->key_size = key_size;
+    c->value_size = value_size;
+    c->slot_size = (u32)align_up(sizeof(SlotHeader) + key_size + value_size, sizeof(u64));
+
+    u32 slots_count = 1;
+    while ((size_t)slots_count * 2 * c->slot_size <= memory_budget && slots_count < (1u << 30)) {
+        slots_count *= 2;
+    }
+    if ((size_t)slots_count * c->slot_size > memory_budget || slots_count < 2) {
+        return;
+    }
+
+    c->slots = calloc(slots_count, c->slot_size);
+    if (!c->slots) {
+        printf("Error allocating %zu bytes for the row cache.\n", memory_budget);
+        exit(EXIT_FAILURE);
+    }
+    c->slots_count = slots_count;
+    c->max_entries = slots_count / 4 * 3;
+    if (c->max_entries == 0) {
+        c->max_entries = 1;
+    }
+}
+
+void row_cache_destroy(RowCache* c)
+{
+    free(c->slots);
+    memset(c, 0, sizeof(*c));
+}
+
+static SlotHeader* slot_header(RowCache* c, u32 index)
+{
+    return (SlotHeader*)(c->slots + (size_t)index * c->slot_size);
+}
+
+static u8* slot_key(RowCache* c, u32 index)
+{
+    return (u8*)slot_header(c, index) + sizeof(SlotHeader);
+}
+
+static u8* slot_value(RowCache* c, u32 index)
+{
+    return slot_key(c, index) + c->key_size;
+}
+
+// Returns the slot holding the key, or the empty slot ending its probe run
+static u32 find_slot(RowCache* c, const void* key, u64 hash)
+{
+    u32 mask = c->slots_count - 1;
+    u32 index = (u32)hash & mask;
+    for (;;) {
+        SlotHeader* header = slot_header(c, index);
+        if (!header->used || (header->hash == hash && memcmp(slot_key(c, index), key, c->key_size) == 0)) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// Backward shift deletion: pull later entries of the probe run into the hole when that keeps them reachable
+static void remove_slot(RowCache* c, u32 hole)
+{
+    u32 mask = c->slots_count - 1;
+    u32 index = hole;
+    for (;;) {
+        index = (index + 1) & mask;
+        SlotHeader* header = slot_header(c, index);
+        if (!header->used) {
+            break;
+        }
+        u32 home = (u32)header->hash & mask;
+        // Distance from home to the hole must not exceed the distance from home to the entry
+        if (((hole - home) & mask) < ((index - home) & mask)) {
+            memcpy(slot_header(c, hole), header, c->slot_size);
+            hole = index;
+        }
+    }
+    slot_header(c, hole)->used = false;
+    c->entries_count--;
+}
+
+static void evict_one(RowCache* c)
+{
+    u32 mask = c->slots_count - 1;
+    for (;;) {
+        u32 index = c->clock_hand;
+        SlotHeader* header = slot_header(c, index);
+        if (header->used) {
+            if (!header->referenced) {
+                remove_slot(c, index);
+                c->evictions++;
+                return;
+            }
+            header->referenced = false;
+        }
+        c->clock_hand = (index + 1) & mask;
+    }
+}
+
+const void* row_cache_get(RowCache* c, const void* key, u64 hash)
+{
+    if (c->slots_count == 0) {
+        c->misses++;
+        return NULL;
+    }
+    u32 index = find_slot(c, key, hash);
+    SlotHeader* header = slot_header(c, index);
+    if (!header->used) {
+        c->misses++;
+        return NULL;
+    }
+    header->referenced = true;
+    c->hits++;
+    return slot_value(c, index);
+}
+
+void row_cache_put(RowCache* c, const void* key, u64 hash, const void* value)
+{
+    if (c->slots_count == 0) {
+        return;
+    }
+    u32 index = find_slot(c, key, hash);
+    if (!slot_header(c, index)->used) {
+        if (c->entries_count >= c->max_entries) {
+            evict_one(c);
+            // Eviction may have shifted entries around, the free slot for this key can have moved
+            index = find_slot(c, key, hash);
+        }
+        c->entries_count++;
+    }
+
+    SlotHeader* header = slot_header(c, index);
+    header->hash = hash;
+    header->used = true;
+    header->referenced = false;
+    memcpy(slot_key(c, index), key, c->key_size);
+    memcpy(slot_value(c, index), value, c->value_size);
+}
+
+void row_cache_remove(RowCache* c, const void* key, u64 hash)
+{
+    if (c->slots_count == 0) {
+        return;
+    }
+    u32 index = find_slot(c, key, hash);
+    if (slot_header(c, index)->used) {
+        remove_slot(c, index);
+    }
+}
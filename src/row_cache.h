@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "int_types.h"
+
+/*
+    Bounded cache of decoded rows in front of the B-tree. It is an open addressing hash table with
+    linear probing over fixed size slots, each holding a key and its value. The slot count is the
+    largest power of two that fits in the memory budget, and at most three quarters of the slots
+    are used so probe sequences stay short.
+    When the cache is full, a CLOCK hand picks the victim: entries that were read since the hand
+    last passed get a second chance. Removal shifts later entries of the probe run back instead of
+    leaving tombstones, so lookups never slow down as entries come and go.
+    Callers hash keys themselves and must pass the same hash for equal keys.
+*/
+typedef struct {
+    u8* slots;
+    u32 slot_size;
+    u32 key_size;
+    u32 value_size;
+    u32 slots_count;
+    u32 max_entries;
+    u32 entries_count;
+    u32 clock_hand;
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+} RowCache;
+
+// A budget too small for a couple of slots leaves the cache disabled, every get then misses
+void row_cache_init(RowCache* c, u32 key_size, u32 value_size, size_t memory_budget);
+void row_cache_destroy(RowCache* c);
+// Returns the cached value or NULL. The pointer is only valid until the next put or remove
+const void* row_cache_get(RowCache* c, const void* key, u64 hash);
+void row_cache_put(RowCache* c, const void* key, u64 hash, const void* value);
+void row_cache_remove(RowCache* c, const void* key, u64 hash);
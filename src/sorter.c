@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sorter.h"
+
+#define SORTER_INITIAL_CAPACITY 64
+
+static void* sorter_alloc(void* data, size_t size)
+{
+    data = realloc(data, size);
+    if (!data && size) {
+        printf("Error allocating %zu bytes for sorting.\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+void sorter_init(Sorter* s, u32 record_size, size_t memory_budget, SorterCompare compare, void* context)
+{
+    assert(s && record_size > 0 && compare && "Must provide a valid Sorter, record size and compare function");
+    memset(s, 0, sizeof(*s));
+    s->record_size = record_size;
+    s->memory_budget = memory_budget;
+    s->compare = compare;
+    s->context = context;
+}
+
+static u8* batch_record(Sorter* s, u32 index)
+{
+    return s->records + (size_t)index * s->record_size;
+}
+
+// Bottom up merge sort of the order indices, stable so equal records keep the order they were added in
+static void sort_batch(Sorter* s)
+{
+    u32* src = s->order;
+    u32* dst = s->scratch;
+    for (u32 width = 1; width < s->records_count; width *= 2) {
+        for (u32 left = 0; left < s->records_count; left += 2 * width) {
+            u32 middle = left + width < s->records_count ? left + width : s->records_count;
+            u32 right = middle + width < s->records_count ? middle + width : s->records_count;
+            u32 i = left;
+            u32 j = middle;
+            u32 k = left;
+            while (i < middle && j < right) {
+                if (s->compare(batch_record(s, src[j]), batch_record(s, src[i]), s->context) < 0) {
+                    dst[k++] = src[j++];
+                } else {
+                    dst[k++] = src[i++];
+                }
+            }
+            while (i < middle) {
+                dst[k++] = src[i++];
+            }
+            while (j < right) {
+                dst[k++] = src[j++];
+            }
+        }
+        u32* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != s->order) {
+        memcpy(s->order, src, s->records_count * sizeof(*s->order));
+    }
+}
+
+static void spill_batch(Sorter* s)
+{
+    sort_batch(s);
+
+    FILE* file = tmpfile();
+    if (!file) {
+        printf("Error creating a temporary file for sorting.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (u32 i = 0; i < s->records_count; i++) {
+        if (fwrite(batch_record(s, s->order[i]), s->record_size, 1, file) != 1) {
+            printf("Error writing a sort run to a temporary file.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (s->runs_count == s->runs_capacity) {
+        s->runs_capacity = s->runs_capacity ? s->runs_capacity * 2 : 4;
+        s->runs = sorter_alloc(s->runs, s->runs_capacity * sizeof(*s->runs));
+    }
+    SorterRun* run = &s->runs[s->runs_count++];
+    memset(run, 0, sizeof(*run));
+    run->file = file;
+    run->records_left = s->records_count;
+    s->records_count = 0;
+}
+
+void sorter_add(Sorter* s, const void* record)
+{
+    assert(!s->merging && "Tried to add a record to a finished Sorter");
+    if (s->records_count == s->records_capacity) {
+        size_t per_record = s->record_size + 2 * sizeof(*s->order);
+        size_t budget_capacity = s->memory_budget / per_record;
+        if (budget_capacity < 2) {
+            budget_capacity = 2;
+        }
+        if (s->records_capacity >= budget_capacity) {
+            spill_batch(s);
+        } else {
+            size_t capacity = s->records_capacity ? (size_t)s->records_capacity * 2 : SORTER_INITIAL_CAPACITY;
+            s->records_capacity = capacity < budget_capacity ? capacity : budget_capacity;
+            s->records = sorter_alloc(s->records, (size_t)s->records_capacity * s->record_size);
+            s->order = sorter_alloc(s->order, s->records_capacity * sizeof(*s->order));
+            s->scratch = sorter_alloc(s->scratch, s->records_capacity * sizeof(*s->scratch));
+        }
+    }
+    memcpy(batch_record(s, s->records_count), record, s->record_size);
+    s->order[s->records_count] = s->records_count;
+    s->records_count++;
+}
+
+static bool run_refill(Sorter* s, SorterRun* run)
+{
+    if (run->records_left == 0) {
+        return false;
+    }
+    u32 count = run->records_left < run->buffer_capacity ? (u32)run->records_left : run->buffer_capacity;
+    if (fread(run->buffer, s->record_size, count, run->file) != count) {
+        printf("Error reading a sort run back from its temporary file.\n");
+        exit(EXIT_FAILURE);
+    }
+    run->records_left -= count;
+    run->buffered = count;
+    run->position = 0;
+    return true;
+}
+
+static const void* run_head(Sorter* s, u32 run_index)
+{
+    SorterRun* run = &s->runs[run_index];
+    return run->buffer + (size_t)run->position * s->record_size;
+}
+
+// Ties go to the earlier run, which keeps the merge stable
+static bool heap_less(Sorter* s, u32 a, u32 b)
+{
+    i32 cmp = s->compare(run_head(s, s->heap[a]), run_head(s, s->heap[b]), s->context);
+    return cmp < 0 || (cmp == 0 && s->heap[a] < s->heap[b]);
+}
+
+static void heap_sift_down(Sorter* s, u32 i)
+{
+    for (;;) {
+        u32 smallest = i;
+        u32 left = 2 * i + 1;
+        u32 right = left + 1;
+        if (left < s->heap_count && heap_less(s, left, smallest)) {
+            smallest = left;
+        }
+        if (right < s->heap_count && heap_less(s, right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        u32 swap = s->heap[i];
+        s->heap[i] = s->heap[smallest];
+        s->heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+void sorter_finish(Sorter* s)
+{
+    if (s->runs_count == 0) {
+        // Everything fit in the budget, hand the records out straight from memory
+        sort_batch(s);
+        s->next_record = 0;
+        return;
+    }
+
+    if (s->records_count > 0) {
+        spill_batch(s);
+    }
+    free(s->records);
+    free(s->order);
+    free(s->scratch);
+    s->records = NULL;
+    s->order = NULL;
+    s->scratch = NULL;
+    s->records_capacity = 0;
+
+    // The budget now goes to the read buffers, split evenly between the runs
+    size_t per_run = s->memory_budget / s->runs_count / s->record_size;
+    if (per_run == 0) {
+        per_run = 1;
+    }
+    if (per_run > UINT32_MAX) {
+        per_run = UINT32_MAX;
+    }
+    s->heap = sorter_alloc(NULL, s->runs_count * sizeof(*s->heap));
+    for (u32 i = 0; i < s->runs_count; i++) {
+        SorterRun* run = &s->runs[i];
+        u64 records_count = run->records_left;
+        run->buffer_capacity = per_run < records_count ? (u32)per_run : (u32)records_count;
+        run->buffer = sorter_alloc(NULL, (size_t)run->buffer_capacity * s->record_size);
+        rewind(run->file);
+        if (run_refill(s, run)) {
+            s->heap[s->heap_count++] = i;
+        }
+    }
+    for (u32 i = s->heap_count; i-- > 0;) {
+        heap_sift_down(s, i);
+    }
+    s->merging = true;
+}
+
+const void* sorter_next(Sorter* s)
+{
+    if (!s->merging) {
+        if (s->next_record >= s->records_count) {
+            return NULL;
+        }
+        return batch_record(s, s->order[s->next_record++]);
+    }
+
+    if (s->advance_top) {
+        s->advance_top = false;
+        SorterRun* run = &s->runs[s->heap[0]];
+        run->position++;
+        if (run->position == run->buffered && !run_refill(s, run)) {
+            s->heap[0] = s->heap[--s->heap_count];
+        }
+        heap_sift_down(s, 0);
+    }
+    if (s->heap_count == 0) {
+        return NULL;
+    }
+    s->advance_top = true;
+    return run_head(s, s->heap[0]);
+}
+
+void sorter_destroy(Sorter* s)
+{
+    for (u32 i = 0; i < s->runs_count; i++) {
+        fclose(s->runs[i].file);
+        free(s->runs[i].buffer);
+    }
+    free(s->runs);
+    free(s->heap);
+    free(s->records);
+    free(s->order);
+    free(s->scratch);
+    memset(s, 0, sizeof(*s));
+}
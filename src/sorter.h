@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "int_types.h"
+
+// Returns <0, 0 or >0 like memcmp. context is whatever was given to sorter_init
+typedef i32 (*SorterCompare)(const void* a, const void* b, void* context);
+
+// A sorted batch spilled to a temporary file, read back through a small buffer while merging
+typedef struct {
+    FILE* file;
+    u64 records_left;
+    u8* buffer;
+    u32 buffer_capacity;
+    u32 buffered;
+    u32 position;
+} SorterRun;
+
+/*
+    Sorts fixed size records within a memory budget. Records are gathered in memory until the
+    budget is used up, then that batch is sorted and written to a temporary file as a run.
+    When every record has been added, the runs are merged k ways and handed out one at a time,
+    so the sorted output never has to fit in memory. Inputs that fit in the budget never touch disk.
+    The sort is stable: records that compare equal come out in the order they were added.
+*/
+typedef struct {
+    u32 record_size;
+    size_t memory_budget;
+    SorterCompare compare;
+    void* context;
+
+    // Current in-memory batch, order holds indices into records and is what actually gets sorted
+    u8* records;
+    u32* order;
+    u32* scratch;
+    u32 records_count;
+    u32 records_capacity;
+    u32 next_record;
+
+    SorterRun* runs;
+    u32 runs_count;
+    u32 runs_capacity;
+    // Min heap of run indices ordered by their current record
+    u32* heap;
+    u32 heap_count;
+    bool merging;
+    // The record last returned by sorter_next is still at the top of the heap, step past it on the next call
+    bool advance_top;
+} Sorter;
+
+void sorter_init(Sorter* s, u32 record_size, size_t memory_budget, SorterCompare compare, void* context);
+void sorter_add(Sorter* s, const void* record);
+// Call once after the last sorter_add, before reading with sorter_next
+void sorter_finish(Sorter* s);
+// Returns NULL when every record has been returned. The record stays valid until the next call
+const void* sorter_next(Sorter* s);
+void sorter_destroy(Sorter* s);
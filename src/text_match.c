@@ -0,0 +1,112 @@
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "text_match.h"
+
+#define SIMD_WIDTH 16
+
+u32 text_length(const char* slot, u32 slot_size)
+{
+    u32 i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (; i + SIMD_WIDTH <= slot_size; i += SIMD_WIDTH) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(slot + i));
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero));
+        if (mask) {
+            return i + (u32)__builtin_ctz(mask);
+        }
+    }
+#endif
+    while (i < slot_size && slot[i]) {
+        i++;
+    }
+    return i;
+}
+
+bool text_equals(const char* a, const char* b, u32 length)
+{
+    u32 i = 0;
+#ifdef __SSE2__
+    for (; i + SIMD_WIDTH <= length; i += SIMD_WIDTH) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+    return memcmp(a + i, b + i, length - i) == 0;
+}
+
+/*
+    Compares the needle's first and last bytes against sixteen candidate positions at once and only
+    runs a full comparison where both match, which rejects almost every position in one step.
+*/
+bool text_contains(const char* text, u32 length, const char* needle, u32 needle_length)
+{
+    if (needle_length == 0) {
+        return true;
+    }
+    if (needle_length > length) {
+        return false;
+    }
+    u32 last_start = length - needle_length;
+    u32 i = 0;
+#ifdef __SSE2__
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    // The block loaded for the last byte ends at i + needle_length - 1 + SIMD_WIDTH
+    for (; i + SIMD_WIDTH <= last_start + 1; i += SIMD_WIDTH) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text + i + needle_length - 1));
+        u32 mask = (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                        _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            u32 start = i + (u32)__builtin_ctz(mask);
+            if (needle_length <= 2 || memcmp(text + start + 1, needle + 1, needle_length - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i <= last_start; i++) {
+        if (text[i] == needle[0] && memcmp(text + i, needle, needle_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Greedy matching that backtracks only to the most recent %, which is enough for LIKE patterns
+bool text_like(const char* text, u32 length, const char* pattern, u32 pattern_length)
+{
+    u32 t = 0;
+    u32 p = 0;
+    bool has_star = false;
+    u32 star_p = 0;
+    u32 star_t = 0;
+    while (t < length) {
+        if (p < pattern_length && pattern[p] == '%') {
+            has_star = true;
+            star_p = ++p;
+            star_t = t;
+        } else if (p < pattern_length && (pattern[p] == '_' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (has_star) {
+            p = star_p;
+            t = ++star_t;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern_length && pattern[p] == '%') {
+        p++;
+    }
+    return p == pattern_length;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "int_types.h"
+
+/*
+    String kernels for filtering rows on their fixed width, zero padded column slots straight from
+    the page bytes. They use SSE2 when the compiler targets it, which every x86-64 build does, and
+    plain loops otherwise. Loads never reach past the lengths they are given, so slots at the very
+    end of a page frame are safe to scan.
+*/
+
+// Length of the text in a slot: up to the first zero byte, or the whole slot if there is none
+u32 text_length(const char* slot, u32 slot_size);
+bool text_equals(const char* a, const char* b, u32 length);
+bool text_contains(const char* text, u32 length, const char* needle, u32 needle_length);
+// SQL LIKE, % matches any run of characters and _ any single one. Case sensitive
+bool text_like(const char* text, u32 length, const char* pattern, u32 pattern_length);
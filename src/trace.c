@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "trace.h"
+
+#define TRACE_MAGIC "MySQLite trace"
+#define TRACE_FORMAT_VERSION 1
+// Far longer than any statement the REPL reads, a larger length means a corrupt trace
+#define TRACE_MAX_TEXT_LENGTH (1024 * 1024)
+#define TRACE_BUFFER_SIZE (256 * 1024)
+
+struct TraceWriter {
+    FILE* file;
+    u64 last_timestamp_ns;
+};
+
+struct TraceReader {
+    FILE* file;
+    u64 last_timestamp_ns;
+    char* text;
+    u32 text_capacity;
+};
+
+static void put_varint(FILE* file, u64 value)
+{
+    while (value >= 0x80) {
+        fputc((int)(value | 0x80) & 0xFF, file);
+        value >>= 7;
+    }
+    fputc((int)value, file);
+}
+
+static bool get_varint(FILE* file, u64* value)
+{
+    *value = 0;
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        *value |= (u64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TraceWriter* trace_writer_open(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    u32 version = TRACE_FORMAT_VERSION;
+    if (fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, file) != 1 || fwrite(&version, sizeof(version), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+    TraceWriter* w = malloc(sizeof(TraceWriter));
+    assert(w && "Out of ram lol");
+    w->file = file;
+    w->last_timestamp_ns = 0;
+    return w;
+}
+
+bool trace_write(TraceWriter* w, const TraceRecord* record)
+{
+    assert(record->timestamp_ns >= w->last_timestamp_ns && "Trace records must come in timestamp order");
+    put_varint(w->file, record->timestamp_ns - w->last_timestamp_ns);
+    put_varint(w->file, record->latency_ns);
+    fputc(record->statement_type, w->file);
+    fputc(record->result, w->file);
+    put_varint(w->file, record->text_length);
+    fwrite(record->text, 1, record->text_length, w->file);
+    w->last_timestamp_ns = record->timestamp_ns;
+    return !ferror(w->file);
+}
+
+bool trace_writer_close(TraceWriter* w)
+{
+    bool ok = !ferror(w->file);
+    ok = fclose(w->file) == 0 && ok;
+    free(w);
+    return ok;
+}
+
+TraceReader* trace_reader_open(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    char magic[sizeof(TRACE_MAGIC)];
+    u32 version;
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 || version != TRACE_FORMAT_VERSION) {
+        fclose(file);
+        errno = EINVAL;
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    TraceReader* r = malloc(sizeof(TraceReader));
+    assert(r && "Out of ram lol");
+    memset(r, 0, sizeof(*r));
+    r->file = file;
+    return r;
+}
+
+TraceReadResult trace_read(TraceReader* r, TraceRecord* record)
+{
+    // Running out of bytes is only fine between records
+    int next = fgetc(r->file);
+    if (next == EOF) {
+        return ferror(r->file) ? TRACE_READ_CORRUPT : TRACE_READ_END;
+    }
+    ungetc(next, r->file);
+
+    u64 delta_ns;
+    u64 latency_ns;
+    u64 text_length;
+    int statement_type;
+    int result;
+    if (!get_varint(r->file, &delta_ns) || !get_varint(r->file, &latency_ns) || (statement_type = fgetc(r->file)) == EOF ||
+        (result = fgetc(r->file)) == EOF || !get_varint(r->file, &text_length) || text_length > TRACE_MAX_TEXT_LENGTH) {
+        return TRACE_READ_CORRUPT;
+    }
+    if (text_length > r->text_capacity) {
+        r->text = realloc(r->text, text_length);
+        assert(r->text && "Out of ram lol");
+        r->text_capacity = (u32)text_length;
+    }
+    if (text_length > 0 && fread(r->text, 1, text_length, r->file) != text_length) {
+        return TRACE_READ_CORRUPT;
+    }
+
+    r->last_timestamp_ns += delta_ns;
+    record->timestamp_ns = r->last_timestamp_ns;
+    record->latency_ns = latency_ns;
+    record->statement_type = (u8)statement_type;
+    record->result = (u8)result;
+    record->text_length = (u32)text_length;
+    record->text = r->text;
+    return TRACE_READ_OK;
+}
+
+void trace_reader_close(TraceReader* r)
+{
+    fclose(r->file);
+    free(r->text);
+    free(r);
+}
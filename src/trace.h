@@ -0,0 +1,42 @@
+#pragma once
+
+#include "int_types.h"
+
+/*
+    Workload traces: every statement a session ran, with when it started, how long it took and
+    what it returned, so the same traffic can be replayed later. The file is a short header and
+    then one record per statement, times as LEB128 varints so a record is usually a few bytes
+    plus the statement's text. Records are buffered, a process that dies loses the last ones.
+*/
+
+typedef struct {
+    // Since the capture started
+    u64 timestamp_ns;
+    u64 latency_ns;
+    u8 statement_type;
+    u8 result;
+    u32 text_length;
+    // Not NUL terminated. Records read back point into the reader, valid until the next trace_read
+    const char* text;
+} TraceRecord;
+
+typedef enum {
+    TRACE_READ_OK,
+    TRACE_READ_END,
+    TRACE_READ_CORRUPT
+} TraceReadResult;
+
+typedef struct TraceWriter TraceWriter;
+typedef struct TraceReader TraceReader;
+
+// Creates or replaces the trace at path. Returns NULL with errno set on failure
+TraceWriter* trace_writer_open(const char* path);
+// Records must come in timestamp order. Returns false with errno set on failure
+bool trace_write(TraceWriter* w, const TraceRecord* record);
+// Flushes and closes, returns false with errno set if the trace could not be written completely
+bool trace_writer_close(TraceWriter* w);
+
+// Returns NULL if path cannot be opened or is not a trace
+TraceReader* trace_reader_open(const char* path);
+TraceReadResult trace_read(TraceReader* r, TraceRecord* record);
+void trace_reader_close(TraceReader* r);
@@ -9,9 +9,9 @@ describe 'database' do
 		"MySQLite test.db"
 	end
 
-	def run_script(commands)
+	def run_script(commands, options = "")
 		raw_output = nil
-		IO.popen("./bin/debug-x64/" + DB_EXECUTABLE, "r+") do |pipe|
+		IO.popen("./bin/debug-x64/" + DB_EXECUTABLE + " " + options, "r+") do |pipe|
 			commands.each do |command|
                 begin
 				    pipe.puts command
@@ -207,7 +207,7 @@ describe 'database' do
         expect(result[14...(result.length)]).to match_array([
             "db > Tree:",
             "- internal (size 1)",
-            "  - leaf (size 7)",
+            "  - leaf (size 13)",
             "    - 1",
             "    - 2",
             "    - 3",
@@ -215,14 +215,14 @@ describe 'database' do
             "    - 5",
             "    - 6",
             "    - 7",
-            "  - key 7",
-            "  - leaf (size 7)",
             "    - 8",
             "    - 9",
             "    - 10",
             "    - 11",
             "    - 12",
             "    - 13",
+            "  - key 13",
+            "  - leaf (size 1)",
             "    - 14",
             "db > Executed.",
             "db > ",
@@ -257,6 +257,22 @@ describe 'database' do
         ])
     end
 
+    it 'keeps a multi-level tree after closing connection' do
+        script = (1..15).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result.length).to eq(17)
+        expect(result.first).to eq("db > (1, user1, person1@example.com)")
+        expect(result[14]).to eq("(15, user15, person15@example.com)")
+    end
+
     it 'allows printing out the structure of a 4-leaf-node btree' do
         script = [
             "insert 18 user18 person18@example.com",
@@ -494,4 +510,748 @@ describe 'database' do
             "db > ",
         ])
     end
+
+    it 'counts splits and statements in stats' do
+        script = (1..14).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result).to include(
+            "leaf_splits: 1",
+            "internal_splits: 0",
+            "root_splits: 1",
+            "select: count 0",
+        )
+        expect(result.any? { |line| line.start_with?("insert: count 14, avg ") }).to eq(true)
+    end
+
+    it 'resets stats' do
+        script = [
+            "insert 1 user1 person1@example.com",
+            ".stats reset",
+            ".stats",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result).to include(
+            "page_cache_hits: 0",
+            "page_cache_misses: 0",
+            "insert: count 0",
+            "select: count 0",
+        )
+    end
+
+    it 'dumps stats as json' do
+        script = [
+            "insert 1 user1 person1@example.com",
+            ".stats json",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result[1]).to start_with('db > {"page_cache_hits":')
+        expect(result[1]).to include('"insert":{"count":1,')
+    end
+
+    it 'derives node capacities from the page size' do
+        result = run_script([".constants", ".exit"], "--page-size 16384")
+        expect(result).to include(
+            "LEAF_NODE_SPACE_FOR_CELLS: 16370",
+            "LEAF_NODE_MAX_CELLS: 55",
+        )
+    end
+
+    it 'keeps the page size from the db header after reopening' do
+        run_script(["insert 1 user1 person1@example.com", ".exit"], "--page-size 65536")
+        expect(File.size("test.db")).to eq(2 * 65536)
+
+        result = run_script([".constants", "select", ".exit"])
+        expect(result).to include(
+            "LEAF_NODE_MAX_CELLS: 220",
+            "db > (1, user1, person1@example.com)",
+        )
+    end
+
+    it 'rejects an invalid page size' do
+        result = run_script([".exit"], "--page-size 5000")
+        expect(result).to eq([
+            "Page size must be a power of two between 4096 and 65536.",
+        ])
+    end
+
+    it 'rejects a file without a db header' do
+        File.write("test.db", "a" * 4096)
+        result = run_script([".exit"])
+        expect(result).to eq([
+            "File is not a MySQLite database.",
+        ])
+    end
+
+    it 'computes file offsets in 64 bits' do
+        run_script(["insert 1 user1 person1@example.com", ".exit"], "--page-size 65536")
+
+        # 65538 pages of 64 KiB end just past 4 GiB, which wraps to the real 2 page length in 32 bits
+        File.open("test.db", "r+b") do |file|
+            file.seek(28)
+            file.write([2 + 65536].pack("L<"))
+        end
+
+        result = run_script([".exit"])
+        expect(result).to eq([
+            "Db file length does not match the 65538 pages in its header. Corrupt file.",
+        ])
+    end
+
+    it 'serves pages from huge page backed frames or their fallback' do
+        script = (1..15).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select"
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--huge-pages")
+
+        expect(result).to include("(15, user15, person15@example.com)")
+        # Hosts without hugetlb or THP fall back to regular pages, the frames must work either way
+        expect(result.any? { |line| line =~ /^page_frames: 4 of 100 \((transparent huge|explicit huge|regular) pages\)$/ }).to eq(true)
+    end
+
+    it 'writes back every modified page on close' do
+        script = [58, 56, 8, 54, 77, 7, 25, 71, 13, 22, 53, 51, 59, 32, 36, 79, 10, 33, 20, 4, 35, 76, 49, 24, 70, 48].map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".btree"
+        script << ".exit"
+        before = run_script(script)
+        tree = before[26...-1]
+        tree[0] = tree[0].sub("db > ", "")
+
+        after = run_script([".btree", ".exit"])
+        expect(after[0...-1]).to eq(["db > " + tree[0]] + tree[1..])
+    end
+
+    it 'prefetches leaves during a cold scan' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        ["", "--no-io-uring"].each do |options|
+            result = run_script(["select", ".stats", ".exit"], options)
+            expect(result).to include("(30, user30, person30@example.com)")
+            expect(result.any? { |line| line =~ /^pages_prefetched: [1-9]/ }).to eq(true)
+        end
+    end
+
+    it 'prefetches the next leaves across parent boundaries' do
+        script = (1..200).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        result = run_script(["select", ".stats", ".check", ".exit"])
+        expect(result).to include("(200, user200, person200@example.com)")
+        counts = result.find { |line| line.start_with?("pages: ") }.match(/(\d+) internal, (\d+) leaf/)
+        internal_count = counts[1].to_i
+        leaf_count = counts[2].to_i
+        # More than one parent at the leaf level, so the scan has to cross from one parent to the next
+        expect(internal_count > 2).to eq(true)
+        # Only the first leaf and the internal nodes above it are read on demand
+        expect(result).to include("pages_prefetched: #{leaf_count - 1}")
+    end
+
+    it 'accepts 64-bit keys' do
+        script = [
+            "insert 9999999999 user1 person1@example.com",
+            "insert 5 user2 person2@example.com",
+            "insert 18446744073709551616 user3 person3@example.com",
+            "select",
+            ".exit",
+        ]
+        result = run_script(script, "--key-type u64")
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > Executed.",
+            "db > ID must be smaller.",
+            "db > (5, user2, person2@example.com)",
+            "(9999999999, user1, person1@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+
+        result = run_script(["select", ".exit"])
+        expect(result).to include("(9999999999, user1, person1@example.com)")
+    end
+
+    it 'orders composite keys by tenant then id' do
+        script = [
+            "insert 2:1 user1 person1@example.com",
+            "insert 1:7 user2 person2@example.com",
+            "insert 1:3 user3 person3@example.com",
+            "insert 1:3 user4 person4@example.com",
+            "insert 4 user5 person5@example.com",
+            "select",
+            ".btree",
+            ".exit",
+        ]
+        result = run_script(script, "--key-type composite")
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Duplicate key.",
+            "db > Syntax error. Could not parse statement 'insert'.",
+            "db > (1:3, user3, person3@example.com)",
+            "(1:7, user2, person2@example.com)",
+            "(2:1, user1, person1@example.com)",
+            "Executed.",
+            "db > Tree:",
+            "- leaf (size 3)",
+            "  - 1:3",
+            "  - 1:7",
+            "  - 2:1",
+            "db > ",
+        ])
+    end
+
+    it 'rejects an unknown key type' do
+        result = run_script([".exit"], "--key-type u16")
+        expect(result).to eq(["Key type must be one of u32, u64 or composite."])
+    end
+
+    it 'splits leaves with wider keys' do
+        script = (1..40).map do |i|
+            "insert #{i % 3}:#{i} user#{i} person#{i}@example.com"
+        end
+        script << "select"
+        script << ".exit"
+        result = run_script(script, "--key-type composite")
+        rows = result.select { |line| line.include?("@example.com") }.map { |line| line.sub("db > ", "") }
+        expected = (1..40).sort_by { |i| [i % 3, i] }.map { |i| "(#{i % 3}:#{i}, user#{i}, person#{i}@example.com)" }
+        expect(rows).to eq(expected)
+    end
+
+    it 'updates rows in place' do
+        script = (1..14).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats reset"
+        script << "update 3 set username=bob, email=bob@example.com"
+        script << "update 9 set email=nine@example.com"
+        script << "update 20 set username=nobody"
+        script << "update 4 set password=x"
+        script << ".stats"
+        script << "select"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result).to include(
+            "db > Key not found.",
+            "db > Syntax error. Could not parse statement 'update'.",
+            "leaf_splits: 0",
+            "(3, bob, bob@example.com)",
+            "(9, user9, nine@example.com)",
+            "(4, user4, person4@example.com)",
+        )
+        expect(result.any? { |line| line.start_with?("update: count 3, avg ") }).to eq(true)
+
+        result = run_script(["select", ".exit"])
+        expect(result).to include("(3, bob, bob@example.com)", "(9, user9, nine@example.com)")
+    end
+
+    it 'dirties a single page per in-place update' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        result = run_script(["update 17 set username=seventeen", ".stats", ".exit"])
+        expect(result).to include("dirty_pages: 1", "leaf_splits: 0")
+        result = run_script(["select", ".exit"])
+        expect(result).to include("(17, seventeen, person17@example.com)")
+    end
+
+    it 'replaces existing rows with insert or replace' do
+        script = [
+            "insert 1 user1 person1@example.com",
+            "insert 1 user2 person2@example.com",
+            "insert or replace 1 user3 person3@example.com",
+            "insert or replace 2 user4 person4@example.com",
+            "insert or update 3 user5 person5@example.com",
+            "select",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > Duplicate key.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement 'insert'.",
+            "db > (1, user3, person3@example.com)",
+            "(2, user4, person4@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'orders rows by a non-key column' do
+        script = [
+            "insert 1 carol carol@b.com",
+            "insert 2 alice zed@a.com",
+            "insert 3 bob bob@c.com",
+            "insert 4 alice alice@d.com",
+            "select order by username",
+            "select order by email desc",
+            "select order by password",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (2, alice, zed@a.com)",
+            "(4, alice, alice@d.com)",
+            "(3, bob, bob@c.com)",
+            "(1, carol, carol@b.com)",
+            "Executed.",
+            "db > (2, alice, zed@a.com)",
+            "(1, carol, carol@b.com)",
+            "(3, bob, bob@c.com)",
+            "(4, alice, alice@d.com)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement 'select'.",
+            "db > ",
+        ])
+    end
+
+    it 'spills sorted runs when the sort exceeds its memory budget' do
+        ids = (1..200).to_a.shuffle(random: Random.new(7))
+        script = ids.map do |i|
+            "insert #{i} user#{i} person#{(i * 37) % 200}@example.com"
+        end
+        script << "select order by email"
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--sort-memory 4096")
+
+        rows = result.select { |line| line.include?("@example.com") }.map { |line| line.sub("db > ", "") }
+        expected = (1..200).sort_by { |i| "person#{(i * 37) % 200}@example.com" }.map do |i|
+            "(#{i}, user#{i}, person#{(i * 37) % 200}@example.com)"
+        end
+        expect(rows).to eq(expected)
+        expect(result.any? { |line| line =~ /^sort_runs_spilled: [1-9]/ }).to eq(true)
+    end
+
+    it 'looks up a single row by id' do
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select where id = 17"
+        script << "select where id = 21"
+        script << "select where id 3"
+        script << ".exit"
+        result = run_script(script)
+        expect(result[20..]).to eq([
+            "db > (17, user17, person17@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement 'select'.",
+            "db > ",
+        ])
+    end
+
+    it 'skips leaf reads for keys missing from the bloom filters' do
+        script = (1..40).map do |i|
+            "insert #{i * 2} user#{i} person#{i}@example.com"
+        end
+        script << "insert 10 dup dup@example.com"
+        script << ".exit"
+        result = run_script(script, "--bloom-filters")
+        expect(result).to include("db > Duplicate key.")
+
+        script = (1..40).map do |i|
+            "select where id = #{i * 2 + 1}"
+        end
+        script << "select where id = 40"
+        script << "update 41 set username=nobody"
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--bloom-filters")
+        expect(result).to include("db > (40, user20, person20@example.com)", "db > Key not found.")
+        skips = result.find { |line| line.start_with?("bloom_filter_skips: ") }.split(": ").last.to_i
+        expect(skips > 30).to eq(true)
+
+        script = (41..60).map do |i|
+            "insert #{i * 2} user#{i} person#{i}@example.com"
+        end
+        script << "select where id = 120"
+        script << "insert 100 dup dup@example.com"
+        script << ".exit"
+        result = run_script(script, "--bloom-filters")
+        expect(result).to include("db > (120, user60, person60@example.com)", "db > Duplicate key.")
+    end
+
+    it 'packs leaves full when keys arrive in order' do
+        script = (1..40).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << ".btree"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result).to include("rightmost_appends: 40", "leaf_splits: 3")
+        leaf_sizes = result.select { |line| line =~ /- leaf \(size/ }.map { |line| line[/\d+/].to_i }
+        expect(leaf_sizes).to eq([13, 13, 13, 1])
+    end
+
+    it 'splits leaves evenly for keys inserted out of order' do
+        script = (1..13).map do |i|
+            "insert #{i * 2} user#{i} person#{i}@example.com"
+        end
+        script << "insert 3 user3 person3@example.com"
+        script << ".btree"
+        script << ".exit"
+        result = run_script(script)
+
+        leaf_sizes = result.select { |line| line =~ /- leaf \(size/ }.map { |line| line[/\d+/].to_i }
+        expect(leaf_sizes).to eq([7, 7])
+    end
+
+    it 'serves repeated point lookups from the row cache' do
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats reset"
+        script << "select where id = 5"
+        script << "select where id = 5"
+        script << "update 5 set username=five"
+        script << "select where id = 5"
+        script << "insert or replace 5 user55 person55@example.com"
+        script << "select where id = 5"
+        script << "select where id = 5"
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--row-cache 65536")
+
+        expect(result[20..26]).to eq([
+            "db > db > (5, user5, person5@example.com)",
+            "Executed.",
+            "db > (5, user5, person5@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > (5, five, person5@example.com)",
+            "Executed.",
+        ])
+        expect(result.count("db > (5, user55, person55@example.com)")).to eq(2)
+        expect(result.any? { |line| line =~ /^row_cache: 1 of \d+ rows, 2 hits, 3 misses, 0 evictions$/ }).to eq(true)
+    end
+
+    it 'evicts rows once the row cache budget is used up' do
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        (1..20).each { |i| script << "select where id = #{i}" }
+        (1..20).each { |i| script << "select where id = #{i}" }
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--row-cache 4096")
+
+        (1..20).each do |i|
+            expect(result.count { |line| line.end_with?("(#{i}, user#{i}, person#{i}@example.com)") }).to eq(2)
+        end
+        expect(result.any? { |line| line =~ /^row_cache: \d+ of 6 rows, \d+ hits, \d+ misses, [1-9]\d* evictions$/ }).to eq(true)
+    end
+
+    it 'backs up an open database, incrementally after the first backup' do
+        `rm -f test_backup.db`
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".backup test_backup.db"
+        script << "update 3 set username=three"
+        script << ".backup test_backup.db"
+        script << "insert 31 user31 person31@example.com"
+        script << ".backup test_backup.db"
+        script << ".exit"
+        result = run_script(script)
+
+        backups = result.select { |line| line.include?("Backed up") }
+        expect(backups[0]).to match(/Backed up 5 of 5 pages \(full, (reflink|copy_file_range|sendfile|read\/write)\)\.$/)
+        expect(backups[1]).to match(/Backed up 1 of 5 pages \(incremental, /)
+        expect(backups[2]).to match(/Backed up [12] of 5 pages \(incremental, /)
+
+        output = nil
+        IO.popen("./bin/debug-x64/MySQLite test_backup.db", "r+") do |pipe|
+            pipe.puts "select where id = 3"
+            pipe.puts "select where id = 31"
+            pipe.puts ".exit"
+            pipe.close_write
+            output = pipe.gets(nil)
+        end
+        expect(output.split("\n")).to include("db > (3, three, person3@example.com)", "db > (31, user31, person31@example.com)")
+        `rm -f test_backup.db`
+    end
+
+    it 'reports backups it cannot write' do
+        result = run_script([".backup /nonexistent/dir/backup.db", ".exit"])
+        expect(result[0]).to start_with("db > Error opening backup file '/nonexistent/dir/backup.db'")
+    end
+
+    it 'filters rows on text columns inside the scan' do
+        script = [
+            "insert 1 alice alice@corp.com",
+            "insert 2 bob bob@home.net",
+            "insert 3 carol carol@corp.com",
+            "insert 4 alicia alicia@corp.community",
+            "select where username = 'alice'",
+            "select where email like '%@corp.com'",
+            "select where username like 'ali%'",
+            "select where email like '%corp%' order by username desc",
+            "select where email like 'b_b@%.net'",
+            "select where username = nobody",
+            "select where password = 'x'",
+            "select where username = 'bob",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result[4..]).to eq([
+            "db > (1, alice, alice@corp.com)",
+            "Executed.",
+            "db > (1, alice, alice@corp.com)",
+            "(3, carol, carol@corp.com)",
+            "Executed.",
+            "db > (1, alice, alice@corp.com)",
+            "(4, alicia, alicia@corp.community)",
+            "Executed.",
+            "db > (3, carol, carol@corp.com)",
+            "(4, alicia, alicia@corp.community)",
+            "(1, alice, alice@corp.com)",
+            "Executed.",
+            "db > (2, bob, bob@home.net)",
+            "Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement 'select'.",
+            "db > Syntax error. Could not parse statement 'select'.",
+            "db > ",
+        ])
+    end
+
+    it 'finds substrings anywhere in long email columns' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} #{'x' * i}needle#{i}#{'y' * (200 - i)}@example.com"
+        end
+        script << "select where email like '%needle17y%'"
+        script << "select where email like '%@example.com'"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[30]).to start_with("db > (17, user17, ")
+        expect(result[31]).to eq("Executed.")
+        expect(result.count { |line| line.end_with?("@example.com)") }).to eq(31)
+    end
+
+    it 'runs entirely in memory and saves snapshots to disk' do
+        `rm -f test_snapshot.db`
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << ".backup test_backup.db"
+        script << ".save test_snapshot.db"
+        script << ".exit"
+        output = nil
+        IO.popen("./bin/debug-x64/MySQLite :memory:", "r+") do |pipe|
+            script.each { |command| pipe.puts command }
+            pipe.close_write
+            output = pipe.gets(nil).split("\n")
+        end
+
+        expect(File.exist?(":memory:")).to eq(false)
+        expect(File.exist?("test_backup.db")).to eq(false)
+        expect(output).to include(
+            "bytes_read: 0",
+            "bytes_written: 0",
+            "db > In-memory databases have no file to back up, use .save instead.",
+            "db > Saved 5 pages to 'test_snapshot.db'.",
+        )
+
+        output = nil
+        IO.popen("./bin/debug-x64/MySQLite test_snapshot.db", "r+") do |pipe|
+            pipe.puts "select"
+            pipe.puts ".exit"
+            pipe.close_write
+            output = pipe.gets(nil).split("\n")
+        end
+        expect(output.count { |line| line.include?("@example.com") }).to eq(30)
+        expect(output).to include("(30, user30, person30@example.com)")
+        `rm -f test_snapshot.db`
+    end
+
+    it 'saves snapshots of file backed databases' do
+        `rm -f test_snapshot.db`
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        result = run_script(["insert 21 user21 person21@example.com", ".save test_snapshot.db", ".exit"])
+        expect(result).to include("db > Saved 4 pages to 'test_snapshot.db'.")
+        expect(File.binread("test_snapshot.db")).to eq(File.binread("test.db"))
+        `rm -f test_snapshot.db`
+    end
+
+    it 'stores compressed pages in less space and reads them back' do
+        script = (1..300).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script, "--page-size 16384 --compress")
+
+        # Compressed pages leave most of their slot as a hole, so far fewer blocks are allocated than the file length
+        expect(File.size("test.db") % 16384).to eq(0)
+        expect(File.stat("test.db").blocks * 512 < File.size("test.db") / 2).to eq(true)
+
+        result = run_script(["select", ".exit"])
+        expect(result.count { |line| line.include?("@example.com") }).to eq(300)
+        expect(result).to include("(300, user300, person300@example.com)")
+    end
+
+    it 'does not compress pages that are a single block' do
+        result = run_script([".exit"], "--compress")
+        expect(result).to eq(["Compressed pages need a page size of at least 8192."])
+    end
+
+    it 'checks the tree and reports its shape' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".check"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[30..36]).to eq([
+            "db > Integrity check: ok",
+            "pages: 5 (1 header, 1 internal, 3 leaf)",
+            "height: 2",
+            "rows: 30",
+            "leaf_fill: 76.9%",
+            "internal_fill: 66.7%",
+            "leaf_fragmentation: 100.0% (2 of 2 leaf hops are not to the next page)",
+        ])
+        expect(result[37]).to match(/^threads: \d+ over 3 subtrees$/)
+    end
+
+    it 'reports corrupt compressed pages instead of exiting' do
+        script = (1..120).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script, "--page-size 8192 --compress")
+
+        # Garble the compressed body of leaf page 2, just past its frame header
+        File.open("test.db", "r+b") do |file|
+            file.seek(2 * 8192 + 12)
+            file.write("\xff" * 40)
+        end
+
+        result = run_script([".check", ".exit"])
+        expect(result[0]).to eq("db > Error: page 2: corrupt compressed page")
+        expect(result.any? { |line| line =~ /^Integrity check: \d+ errors$/ }).to eq(true)
+        expect(result).to include("rows: 93")
+    end
+
+    it 'finds broken parent pointers and leaf chains' do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        # Leaf pages 2 and 4 hold keys 14 to 26 and 27 to 30 under the root on page 1
+        File.open("test.db", "r+b") do |file|
+            file.seek(2 * 4096 + 10)
+            file.write([0].pack("V"))
+            file.seek(4 * 4096 + 2)
+            file.write([3].pack("V"))
+        end
+
+        result = run_script([".check", ".exit"])
+        expect(result[0..2]).to eq([
+            "db > Error: page 4: parent pointer is 3, expected 1",
+            "Error: page 2: next leaf is 0, expected 4",
+            "Integrity check: 2 errors",
+        ])
+    end
+
+    it 'captures statements and replays them against another database' do
+        `rm -f test.trace test_replay.db`
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "insert 3 user3 person3@example.com"
+        script << "select where id = 7"
+        script << "bogus"
+        script << ".exit"
+        run_script(script, "--capture test.trace")
+        expect(File.exist?("test.trace")).to eq(true)
+
+        report = `./bin/debug-x64/MySQLite-replay test.trace test_replay.db --max-speed`.split("\n")
+        expect($?.success?).to eq(true)
+        expect(report[0]).to start_with("Replayed 22 statements in ")
+        expect(report[0]).to include("at max speed")
+        expect(report[1]).to start_with("insert: count 21, throughput ")
+        expect(report[1].end_with?(", mismatches 0")).to eq(true)
+        expect(report[2]).to start_with("insert captured: count 21, p50 ")
+        expect(report[3]).to start_with("select: count 1, throughput ")
+        expect(report[3].end_with?(", mismatches 0")).to eq(true)
+
+        result = `echo "select where id = 20" | ./bin/debug-x64/MySQLite test_replay.db`.split("\n")
+        expect(result[0]).to eq("db > (20, user20, person20@example.com)")
+
+        # The rows are there already, so every insert now fails where it succeeded before
+        report = `./bin/debug-x64/MySQLite-replay test.trace test_replay.db`.split("\n")
+        expect(report[0]).to include("at original speed")
+        expect(report[1].end_with?(", mismatches 20")).to eq(true)
+        `rm -f test.trace test_replay.db`
+    end
+
+    it 'rejects files that are not traces' do
+        run_script(["insert 1 user1 person1@example.com", ".exit"])
+        result = `./bin/debug-x64/MySQLite-replay test.db test_replay.db 2>&1`.split("\n")
+        expect($?.success?).to eq(false)
+        expect(result).to match_array(["Unable to read trace 'test.db': Invalid argument"])
+    end
+
+    it 'keeps the tree intact under shuffled inserts' do
+        [3, 19, 20].each do |seed|
+            `rm -rf test.db`
+            ids = (1..300).to_a.shuffle(random: Random.new(seed))
+            script = ids.map do |i|
+                "insert #{i} user#{i} person#{i}@example.com"
+            end
+            script << ".exit"
+            run_script(script)
+
+            script = (1..300).map do |i|
+                "select where id = #{i}"
+            end
+            script << ".check"
+            script << ".exit"
+            result = run_script(script)
+            expect(result.count { |line| line =~ /\(\d+, user\d+, person\d+@example\.com\)/ }).to eq(300)
+            expect(result).to include("db > Integrity check: ok")
+        end
+    end
 end
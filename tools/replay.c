@@ -0,0 +1,176 @@
+// nanosleep needs POSIX
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <io.h>
+#include <windows.h>
+#define NULL_DEVICE "NUL"
+#else
+#include <unistd.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#include "array.h"
+#include "db.h"
+#include "int_types.h"
+#include "trace.h"
+
+/*
+    Re-executes a trace captured with --capture against a database file. Statements run through the
+    same prepare and execute calls as the REPL, either spaced out as they were captured or back to
+    back with --max-speed, and the report compares their latencies with the captured ones. Rows the
+    statements print go to the null device so only the report is written to stdout.
+*/
+
+typedef struct {
+    LatencyHistogram replayed;
+    LatencyHistogram captured;
+    // Statements that returned a different result than when they were captured
+    u64 mismatches;
+} ReplayTypeStats;
+
+void sleep_until(u64 deadline_ns)
+{
+    u64 now = now_ns();
+    if (now >= deadline_ns) {
+        return;
+    }
+    u64 wait_ns = deadline_ns - now;
+#ifdef PLATFORM_WINDOWS
+    Sleep((DWORD)(wait_ns / 1000000));
+#else
+    struct timespec ts = {.tv_sec = (time_t)(wait_ns / 1000000000ull), .tv_nsec = (long)(wait_ns % 1000000000ull)};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+#endif
+}
+
+void print_usage()
+{
+    printf("Usage: MySQLite-replay <trace> <database file> [--max-speed] [database options]\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    DbOptions options = default_db_options();
+    bool max_speed = false;
+    for (i32 i = 3; i < argc; i++) {
+        if (parse_db_option(argc, argv, &i, &options)) {
+            continue;
+        }
+        if (strcmp(argv[i], "--max-speed") == 0) {
+            max_speed = true;
+        } else {
+            printf("Unknown option '%s'.\n", argv[i]);
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    TraceReader* trace = trace_reader_open(argv[1]);
+    if (!trace) {
+        printf("Unable to read trace '%s': %s\n", argv[1], strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    Table* table = db_open(argv[2], &options);
+    // The report keeps the real stdout, the engine's own output is thrown away
+    fflush(stdout);
+    FILE* report = fdopen(dup(fileno(stdout)), "w");
+    if (!report || !freopen(NULL_DEVICE, "w", stdout)) {
+        fprintf(stderr, "Unable to redirect statement output: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    ReplayTypeStats stats[STATEMENT_TYPES_COUNT];
+    memset(stats, 0, sizeof(stats));
+    u64 statements_count = 0;
+    u64 prepare_failures = 0;
+    TraceReadResult read_result;
+    TraceRecord record;
+    StringBuilder sb = {0};
+    u64 replay_start_ns = now_ns();
+    while ((read_result = trace_read(trace, &record)) == TRACE_READ_OK) {
+        if (record.statement_type >= STATEMENT_TYPES_COUNT) {
+            read_result = TRACE_READ_CORRUPT;
+            break;
+        }
+        if (!max_speed) {
+            sleep_until(replay_start_ns + record.timestamp_ns);
+        }
+
+        sb.count = 0;
+        ARRAY_APPEND_MANY(&sb, record.text, record.text_length);
+        ARRAY_APPEND_MANY(&sb, "", 1);
+        Statement statement;
+        if (prepare_statement(&sb, table, &statement) != PREPARE_SUCCESS) {
+            // Only prepared statements are captured, so the trace was made with other database options
+            prepare_failures++;
+            continue;
+        }
+
+        u64 start_ns = now_ns();
+        ExecuteResult result = execute_statement(&statement, table);
+        u64 latency_ns = now_ns() - start_ns;
+        latency_histogram_record(&table->stats.statement_latency[statement.type], latency_ns);
+
+        ReplayTypeStats* type_stats = &stats[statement.type];
+        latency_histogram_record(&type_stats->replayed, latency_ns);
+        latency_histogram_record(&stats[record.statement_type].captured, record.latency_ns);
+        if (result != record.result || statement.type != record.statement_type) {
+            type_stats->mismatches++;
+        }
+        statements_count++;
+    }
+    u64 elapsed_ns = now_ns() - replay_start_ns;
+    db_close(table);
+    trace_reader_close(trace);
+    ARRAY_FREE(&sb);
+
+    double elapsed_s = (double)elapsed_ns / 1e9;
+    fprintf(report, "Replayed %llu statements in %.3fs at %s, %.0f statements/s\n",
+            (unsigned long long)statements_count, elapsed_s, max_speed ? "max speed" : "original speed",
+            elapsed_s > 0 ? (double)statements_count / elapsed_s : 0.0);
+    for (u32 i = 0; i < STATEMENT_TYPES_COUNT; i++) {
+        ReplayTypeStats* s = &stats[i];
+        if (s->replayed.count == 0 && s->captured.count == 0) {
+            continue;
+        }
+        // Throughput over the time spent executing, which does not depend on how the trace was paced
+        double busy_s = (double)s->replayed.total_ns / 1e9;
+        fprintf(report, "%s: count %llu, throughput %.0f/s, p50 %lluns, p90 %lluns, p99 %lluns, max %lluns, mismatches %llu\n",
+                statement_type_name((StatementType)i), (unsigned long long)s->replayed.count,
+                busy_s > 0 ? (double)s->replayed.count / busy_s : 0.0,
+                (unsigned long long)latency_histogram_percentile(&s->replayed, 50),
+                (unsigned long long)latency_histogram_percentile(&s->replayed, 90),
+                (unsigned long long)latency_histogram_percentile(&s->replayed, 99),
+                (unsigned long long)s->replayed.max_ns, (unsigned long long)s->mismatches);
+        fprintf(report, "%s captured: count %llu, p50 %lluns, p90 %lluns, p99 %lluns, max %lluns\n",
+                statement_type_name((StatementType)i), (unsigned long long)s->captured.count,
+                (unsigned long long)latency_histogram_percentile(&s->captured, 50),
+                (unsigned long long)latency_histogram_percentile(&s->captured, 90),
+                (unsigned long long)latency_histogram_percentile(&s->captured, 99),
+                (unsigned long long)s->captured.max_ns);
+    }
+    if (prepare_failures > 0) {
+        fprintf(report, "Failed to prepare %llu statements.\n", (unsigned long long)prepare_failures);
+    }
+    if (read_result == TRACE_READ_CORRUPT) {
+        fprintf(report, "Trace is corrupt after %llu statements.\n", (unsigned long long)statements_count);
+        fclose(report);
+        exit(EXIT_FAILURE);
+    }
+    fclose(report);
+    exit(EXIT_SUCCESS);
+}